@@ -21,6 +21,7 @@
 namespace gamepad {
 namespace defaults {
     extern const char* linux_bind_json;
+    extern const char* evdev_bind_json;
     extern const char* dinput_bind_json;
     extern const char* xinput_bind_json;
 }
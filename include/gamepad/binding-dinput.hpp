@@ -37,6 +37,7 @@ namespace cfg {
 #if LGP_WINDOWS
         binding_dinput(const std::string& json);
         virtual void copy(const std::shared_ptr<binding> other) override;
+        std::shared_ptr<binding> clone() const override { return std::make_shared<binding_dinput>(*this); }
 #ifdef LGP_ENABLE_JSON
         binding_dinput(const json11::Json& j);
         bool load(const json11::Json& j) override;
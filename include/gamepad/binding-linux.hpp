@@ -25,13 +25,16 @@
 
 namespace gamepad {
 class device_linux;
+class device_evdev;
 namespace cfg {
 
 #ifdef LGP_ENABLE_JSON
     extern json11::Json linux_default_binding;
+    extern json11::Json evdev_default_binding;
 #endif
     class binding_linux : public binding {
         friend class gamepad::device_linux;
+        friend class gamepad::device_evdev;
 
     public:
         binding_linux() = default;
@@ -40,6 +43,7 @@ namespace cfg {
 #ifdef LGP_ENABLE_JSON
         binding_linux(const json11::Json& j);
 #endif
+        std::shared_ptr<binding> clone() const override { return std::make_shared<binding_linux>(*this); }
     };
 }
 }
@@ -38,6 +38,7 @@ namespace cfg {
         binding_xinput(const json11::Json& j);
 #endif
 #endif
+        std::shared_ptr<binding> clone() const override { return std::make_shared<binding_xinput>(*this); }
     };
 }
 }
@@ -21,20 +21,65 @@
 #include <cstdint>
 #include <json/json11.hpp>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 
 namespace gamepad {
 namespace cfg {
     using mappings = std::map<uint16_t, uint16_t>;
 
+    /* Compiled mappings of a binding. Tables with the same content are interned,
+     * so identical bindings share one instance, which makes them immutable
+     * once they've been handed out */
+    struct mapping_table {
+        mappings buttons;
+        mappings axis;
+
+        uint16_t map_button(uint16_t native) const { return find(buttons, native); }
+        uint16_t map_axis(uint16_t native) const { return find(axis, native); }
+
+        bool operator==(const mapping_table& other) const { return buttons == other.buttons && axis == other.axis; }
+        size_t hash() const;
+
+        /* Returns the shared instance with the same content as table */
+        static std::shared_ptr<const mapping_table> intern(mapping_table&& table);
+
+    private:
+        static uint16_t find(const mappings& m, uint16_t native)
+        {
+            auto it = m.find(native);
+            return it == m.end() ? 0 : it->second;
+        }
+    };
+
     class binding {
+        /* Set once a hook indexed the binding by name, see get_rename_count() */
+        bool m_indexed = false;
+
     protected:
         std::string m_binding_name;
-        mappings m_buttons_mappings;
-        mappings m_axis_mappings;
+
+        /* Never null, only accessed through std::atomic_load/store since
+         * the hook thread reads it while it might be replaced. Interned
+         * tables are never modified */
+        std::shared_ptr<const mapping_table> m_table;
+
+        /* The table m_table holds once it was edited, it's only used by this
+         * binding until commit() interns it again */
+        mapping_table* m_private = nullptr;
+        mutable std::mutex m_table_mutex; /* Guards m_private and replacing m_table */
+
+        /* Replaces the mappings, e.g. after they were loaded */
+        void set_table(std::shared_ptr<const mapping_table> table);
+        /* The mappings as a table other bindings can share */
+        std::shared_ptr<const mapping_table> share_table() const;
 
     public:
-        binding() = default;
+        binding();
+        binding(const binding& other);
+        binding& operator=(const binding& other);
+        virtual ~binding() = default;
         binding(const std::string& json);
 #ifdef LGP_ENABLE_JSON
         binding(const json11::Json& j);
@@ -46,12 +91,35 @@ namespace cfg {
         virtual bool load(const std::string& json);
         virtual void save(std::string& json);
         virtual void copy(const std::shared_ptr<binding> other);
+
+        /* Creates a new binding of the same type, which shares the
+         * mapping table with this one until either of them is modified */
+        virtual std::shared_ptr<binding> clone() const { return std::make_shared<binding>(*this); }
+
         const std::string& get_name() const { return m_binding_name; }
-        void set_name(const std::string& name) { m_binding_name = name; }
-        mappings& get_button_mappings() { return m_buttons_mappings; }
-        mappings& get_axis_mappings() { return m_axis_mappings; }
-        const mappings& get_button_mappings() const { return m_buttons_mappings; }
-        const mappings& get_axis_mappings() const { return m_axis_mappings; }
+        void set_name(const std::string& name);
+
+        /* Counts renames of bindings a hook indexed, hooks rebuild their index once it changed */
+        static uint64_t get_rename_count();
+        void mark_indexed() { m_indexed = true; }
+        std::shared_ptr<const mapping_table> get_table() const { return std::atomic_load(&m_table); }
+
+        /* Copy on write, the first edit gives the binding its own copy of the
+         * mappings, which takes effect right away. Other bindings that shared
+         * them aren't affected, later edits change the copy in place */
+        mapping_table& edit();
+
+        /* Interns the edited mappings, so they're shared with other bindings
+         * that have the same ones again */
+        void commit();
+        void intern() { commit(); }
+
+        /* Edits, see edit() */
+        mappings& get_button_mappings() { return edit().buttons; }
+        mappings& get_axis_mappings() { return edit().axis; }
+        /* Only valid until the mappings are replaced, e.g. by commit() or load() */
+        const mappings& get_button_mappings() const { return get_table()->buttons; }
+        const mappings& get_axis_mappings() const { return get_table()->axis; }
     };
 }
 }
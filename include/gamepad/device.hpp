@@ -20,9 +20,11 @@
 
 #include "binding.hpp"
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
 namespace gamepad {
@@ -115,7 +117,8 @@ protected:
 
     /* Instance of the bindings used for this device
      * This uses bindings matched for the hook that is
-     * used for this device
+     * used for this device. Only accessed through std::atomic_load/store
+     * so bindings can be swapped while the hook thread is running
      */
     std::shared_ptr<cfg::binding> m_binding;
     bool m_valid = false;
@@ -123,6 +126,28 @@ protected:
     /* Device index assigned when querying the devices */
     int m_index = 0;
 
+    /* Times the platform dropped input because it wasn't read fast enough */
+    uint32_t m_overflow_count = 0;
+
+    /* Times the device came back after its connection was lost, and how long
+     * the last reconnect took from finding it again to reading it in microseconds */
+    uint32_t m_reconnect_count = 0;
+    uint64_t m_reconnect_latency = 0;
+
+    /* With lazy opening the hook only opens devices that are in use, which
+     * is either subscribed or its state was read since the last check */
+    std::atomic<uint32_t> m_subscribers { 0 };
+    mutable std::atomic<bool> m_accessed { false };
+
+    void touch() const { m_accessed.store(true, std::memory_order_relaxed); }
+
+    /* Requested with set_enabled(), m_read_enabled is what the hook thread applied */
+    std::atomic<bool> m_enabled { true };
+    bool m_read_enabled = true;
+
+    /* See get_input_mutex() */
+    std::mutex m_input_mutex;
+
     void button_event(uint16_t native_id, uint16_t vc, int32_t value, float vv);
     void axis_event(uint16_t native_id, uint16_t vc, int32_t value, float vv);
 
@@ -165,24 +190,83 @@ public:
      */
     virtual const std::string& get_cache_id() { return get_id(); }
 
-    bool is_button_pressed(uint16_t code) { return m_buttons[code]; }
+    bool is_button_pressed(uint16_t code)
+    {
+        touch();
+        return m_buttons[code];
+    }
 
-    float get_axis(uint16_t axis) { return m_axis[axis]; }
+    float get_axis(uint16_t axis)
+    {
+        touch();
+        return m_axis[axis];
+    }
 
-    const std::map<uint16_t, bool>& get_buttons() const { return m_buttons; }
+    const std::map<uint16_t, bool>& get_buttons() const
+    {
+        touch();
+        return m_buttons;
+    }
 
-    std::map<uint16_t, bool>& get_buttons() { return m_buttons; }
+    std::map<uint16_t, bool>& get_buttons()
+    {
+        touch();
+        return m_buttons;
+    }
 
-    const std::map<uint16_t, float>& get_axis() const { return m_axis; }
+    const std::map<uint16_t, float>& get_axis() const
+    {
+        touch();
+        return m_axis;
+    }
 
-    std::map<uint16_t, float>& get_axis() { return m_axis; }
+    std::map<uint16_t, float>& get_axis()
+    {
+        touch();
+        return m_axis;
+    }
+
+    /* Keeps the device open while the hook opens devices lazily, every
+     * subscribe() needs a matching unsubscribe() */
+    void subscribe() { m_subscribers++; }
+    void unsubscribe() { m_subscribers--; }
+    bool is_subscribed() const { return m_subscribers > 0; }
+
+    /* True if the state was read since the last call */
+    bool take_accessed() { return m_accessed.exchange(false, std::memory_order_relaxed); }
 
     bool is_valid() const { return m_valid; }
 
+    uint32_t get_overflow_count() const { return m_overflow_count; }
+    uint32_t get_reconnect_count() const { return m_reconnect_count; }
+    uint64_t get_reconnect_latency() const { return m_reconnect_latency; }
+
+    /* True if input was read, but not processed yet, update() should be called again */
+    virtual bool has_pending() const { return false; }
+
+    /* Disabled devices stay open and keep their binding, but the hook doesn't read them
+     * or call any handlers for them. Use hook::set_device_enabled(), so the hook thread
+     * applies it right away */
+    void set_enabled(bool enabled) { m_enabled = enabled; }
+    bool is_enabled() const { return m_enabled; }
+
+    /* Whether the hook thread reads the device, follows is_enabled() once it applied it */
+    bool is_read_enabled() const { return m_read_enabled; }
+    void set_read_enabled(bool enabled) { m_read_enabled = enabled; }
+
+    /* Held while the device's state is updated and its handlers are called,
+     * use this to safely read the state of devices read on io threads */
+    std::mutex* get_input_mutex() { return &m_input_mutex; }
+
+    /* Drops input that was queued or read, but not applied yet */
+    virtual void discard_input()
+    { /* NO-OP */
+    }
+
     void invalidate() { m_valid = false; }
     void set_valid() { m_valid = true; }
 
-    bool has_binding() const { return m_binding != nullptr; }
+    bool has_binding() const { return std::atomic_load(&m_binding) != nullptr; }
 
     const input_event* last_button_event() const { return &m_last_button_event; }
     input_event* last_button_event() { return &m_last_button_event; }
@@ -190,12 +274,18 @@ public:
     const input_event* last_axis_event() const { return &m_last_axis_event; }
     input_event* last_axis_event() { return &m_last_axis_event; }
 
-    std::shared_ptr<cfg::binding> get_binding() { return m_binding; }
+    std::shared_ptr<cfg::binding> get_binding() { return std::atomic_load(&m_binding); }
 
     virtual void set_binding(std::shared_ptr<cfg::binding> b)
     {
-        m_binding.reset();
-        m_binding = b;
+        std::atomic_store(&m_binding, b);
+    }
+
+    /* Lets the device drop native events its binding doesn't use before
+     * they reach the library, where the platform supports it. Disable it
+     * to receive every native event, e.g. while creating a binding */
+    virtual void set_event_filter(bool)
+    { /* NO-OP */
     }
 
     virtual void deinit()
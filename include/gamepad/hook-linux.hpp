@@ -22,23 +22,200 @@
 
 #ifdef LGP_LINUX
 namespace gamepad {
+template <class T>
+class mpsc_queue;
+class io_engine;
+class device_node;
+class reactor;
+
+/* Engines that read on their own threads call the event handlers of different
+ * devices at the same time, each with the input mutex of its device held only */
+/* clang-format off */
+namespace io_engine_type {
+enum type : uint8_t {
+    READ,                               /* Every device is read on every iteration of the
+                                         * hook thread, the default                             */
+    EPOLL,                              /* The hook thread waits for input with epoll and only
+                                         * reads devices that have some                         */
+    IO_URING,                           /* Every device has a read posted with io_uring, which
+                                         * is only resubmitted once it completed, Linux 5.11+   */
+    THREAD_PER_DEVICE,                  /* Every device gets a thread that blocks until it has
+                                         * input and calls the event handlers right away, for
+                                         * the lowest latency with a few devices                */
+    SHARDED,                            /* Devices are spread over a few threads that wait with
+                                         * epoll and take over each others backlog, for
+                                         * hundreds of devices                                  */
+    AUTO,                               /* io_uring if the kernel supports it, otherwise epoll  */
+    SHARED                              /* Used by hooks created with hook_type::SHARED, the
+                                         * shared reactor reads the devices, can't be selected  */
+};
+}
+/* clang-format on */
+
 class hook_linux : public hook {
 
-    /* Check for devices in /dev/input/by-id, which gives us better device ids
-     * to tell similiar gamepads apart, but will cause issues when using xboxdrv
-     * or gamepads that don't show up in /dev/input/by-id
-     */
-    void check_dev_by_id();
-
-    /* Check for devices in /dev/js*, sadly this doesn't give us much to identify the gamepad
-     * so if you have multiple identical gamepads identification will come down to which
-     * /dev/js* path they're connected as, which usually means the order in which they are
-     * connected*/
-    void check_js();
+    /* Discovery is incremental: a scan is skipped entirely while the device
+     * folder's fingerprint is unchanged, otherwise its entries are diffed
+     * against the node index and only added and removed nodes are handled */
+    struct folder_fingerprint {
+        uint64_t dev = 0, ino = 0;
+        int64_t mtime_sec = 0, mtime_nsec = 0;
+        bool valid = false;
+
+        bool operator==(const folder_fingerprint& o) const
+        {
+            return valid == o.valid && dev == o.dev && ino == o.ino && mtime_sec == o.mtime_sec
+                && mtime_nsec == o.mtime_nsec;
+        }
+    };
+
+    /* A node seen in the last scan, the device is empty for nodes that
+     * aren't gamepads, so they're not probed again until they change */
+    struct node_entry {
+        uint64_t ino = 0;
+        uint32_t generation = 0; /* Last scan that saw the node */
+        std::weak_ptr<device> dev;
+    };
+
+public:
+    struct node {
+        std::string path;
+        uint64_t ino;
+    };
+
+    /* Result of one scan of the device folder */
+    struct scan_result {
+        std::vector<node> added;
+        std::vector<std::string> removed;
+    };
+
+private:
+    /* Devices are probed and opened by the discovery thread, or the caller of
+     * query_devices(), and handed to the hook thread through m_discovered, so
+     * input reading never waits on directory walks, open() or ioctls */
+    struct discovery_event;
+    std::unique_ptr<mpsc_queue<discovery_event>> m_discovered;
+    std::thread m_discovery_thread;
+    int m_discovery_wake_fd = -1;
+
+    /* Serializes probe passes, the node index has its own lock since
+     * get_device_by_path may be called from inside event handlers */
+    std::mutex m_discovery_mutex;
+    std::mutex m_index_mutex;
+    folder_fingerprint m_fingerprint;
+    std::unordered_map<std::string, node_entry> m_node_index;
+    uint32_t m_scan_generation = 0;
+    bool m_rescan = false; /* A node failed to open, scan again even if the folder didn't change */
+
+    /* /dev/input/by-id gives us better device ids to tell similiar gamepads apart,
+     * but will cause issues when using xboxdrv or gamepads that don't show up there.
+     * /dev/input/js* doesn't give us much to identify the gamepad, so if you have
+     * multiple identical gamepads identification will come down to which
+     * /dev/input/js* path they're connected as, which usually means the order in
+     * which they are connected. /dev/input/event* nodes are only kept if they
+     * report gamepad or joystick buttons, which also filters out keyboards and mice */
+    const char* device_folder() const;
+    bool is_candidate(const char* name) const;
+
+    /* Diffs the device folder against the node index, returns false if
+     * the folder didn't change since the last scan */
+    bool scan(scan_result& result);
+
+    /* Scans and queues added and removed devices without holding the hook mutex,
+     * with parallel set new nodes are probed concurrently on a few workers */
+    scan_result probe_devices(bool parallel = false);
+
+    /* Opens the device at path, or reopens its cached instance. Devices are
+     * identified through sysfs before their node is opened, so a gamepad that
+     * comes back as another node gets its cached instance back. irrelevant is
+     * set for nodes that aren't gamepads */
+    std::shared_ptr<device> probe_node(const std::string& path, bool& irrelevant);
+
+    /* Async start, the discovery thread probes the initial nodes and
+     * the hook thread reports ready once it adopted all of them */
+    std::atomic<bool> m_initial_probed { false };
+    bool m_awaiting_ready = false;
+
+    /* Devices restored by load_warm_state by cache id, they get a connect instead
+     * of a reconnect event when they're found. Holding them here keeps them from
+     * being dropped from the device cache until then. Guarded by m_mutex */
+    std::unordered_map<std::string, std::shared_ptr<device>> m_warm_devices;
+
+    /* Opens devices that are used and closes idle ones while lazy opening
+     * is enabled, and opens all of them once after it was disabled */
+    bool m_lazy_active = false;
+    void update_lazy_devices();
+
+    /* Only the consumer of m_discovered adopts devices: the hook thread while it runs,
+     * the thread calling pump() while pumped, otherwise the caller of query_devices() */
+    bool adopts_on_this_thread() const;
+    /* Bumped by close_devices(), events queued before are dropped when they're adopted */
+    std::atomic<uint32_t> m_discovery_epoch { 0 };
+    static void drop_event(discovery_event& e);
+
+    /* Discovery is started by start(), start_async() and controls, under m_discovery_start_mutex */
+    std::mutex m_discovery_start_mutex;
+    void discovery_thread(bool initial);
+    void start_discovery(bool initial = false);
+    void stop_discovery();
+    /* Picks up a new plug and play setting, keeps an initial probe that didn't run yet */
+    void restart_discovery();
+    std::atomic<bool> m_rescan_requested { false };
+
+    /* Wakes the hook thread for controls, it waits on it together with the io engine */
+    int m_control_fd = -1;
+    void wake_hook_thread() override;
+    void apply_control(const control& c) override;
+    void apply_enabled(const std::shared_ptr<device>& dev, bool enabled) override;
+    void catch_up(const std::shared_ptr<device>& dev) override;
+
+    void adopt_devices() override;
+    bool discovers_async() const override { return true; }
+
+    /* Engine the hook thread waits on, nullptr for io_engine_type::READ */
+    std::unique_ptr<io_engine> m_engine;
+    /* Set for hook_type::SHARED, opens the nodes, reads them and runs discovery */
+    std::shared_ptr<reactor> m_reactor;
+    bool m_discovery_shared = false; /* Probe passes are registered with the reactor */
+    bool wait_for_input(ns timeout) override;
+    /* Engines with a descriptor are polled through it, without one the device
+     * descriptors are. Engines dispatching on their own threads can't spin */
+    bool poll_input() override;
+    bool start_spin() override;
+    /* Hands devices that were opened since the last wait to the engine */
+    void attach_devices();
+
+    /* Pump mode, m_pump_fd is an epoll set of the engine's descriptor, an inotify
+     * watch on the device folder, the control eventfd and m_pump_wake_fd, which
+     * pump() signals when it left work for the next call */
+    int m_pump_fd = -1;
+    int m_pump_wake_fd = -1;
+    int m_hotplug_fd = -1;
+    void stop_pump();
+
+    /* Updates a device once an io thread saw or read input, see io_dispatch. Only the
+     * device's input mutex is held, so devices are handled by several threads at once */
+    void dispatch_device(
+        const std::weak_ptr<device_node>& node, const std::atomic<bool>& detached, const void* data, ssize_t len);
+
     const uint16_t m_flags = 0;
 
+    /* Bindings file watch, the watch thread waits on the inotify descriptor
+     * and reloads the bindings whenever the file is written or replaced */
+    std::thread m_watch_thread;
+    std::string m_watch_path;
+    std::string m_watch_file;
+    int m_watch_fd = -1;
+    int m_watch_wake_fd = -1;
+
+    void watch_thread();
+
 public:
     hook_linux(uint16_t flags);
+    ~hook_linux();
+
+    bool watch_bindings(const std::string& path) override;
+    void unwatch_bindings() override;
 
 #ifdef LGP_ENABLE_JSON
     virtual std::shared_ptr<cfg::binding> make_native_binding(const json11::Json& j) override;
@@ -46,6 +223,29 @@ public:
 #endif
 
     void query_devices() override;
+    void close_devices() override;
+    void stop() override;
+    bool start() override;
+    bool start_async() override;
+
+    /* Needs an engine with a descriptor, READ is switched to EPOLL. Nodes are
+     * probed by pump() once the device folder changed, there is no discovery thread */
+    bool start_pump() override;
+    int get_poll_fd() const override { return m_pump_fd; }
+    int pump(int max_events = 64) override;
+
+    /* Selects how the hook thread gets input from the devices, has to be called
+     * while the hook isn't running. threads is the number of io threads for
+     * SHARDED, zero uses one per cpu. Returns false if the engine isn't available */
+    bool set_io_engine(io_engine_type::type type, unsigned threads = 0);
+    io_engine_type::type get_io_engine() const;
+
+    bool save_warm_state(const std::string& path) override;
+    bool load_warm_state(const std::string& path) override;
+
+    /* Scans the device folder and applies the difference right away,
+     * returns the nodes that were added and removed */
+    scan_result discover();
     std::shared_ptr<device> get_device_by_path(const std::string& path);
 };
 }
@@ -21,10 +21,14 @@
 #include "config.h"
 #include "device.hpp"
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace gamepad {
@@ -48,9 +52,23 @@ enum type : uint16_t {
     BY_ID = 1 << 4,                     /* Finds gamepads in /dev/input/by-id/ provides better
                                          * devices ids, but causes issues with things like
                                          * xboxdrv or devices that don't show up in the folder  */
+    EVDEV = 1 << 5,                     /* Finds gamepads in /dev/input/event* by their
+                                         * capabilities, applies input one hardware report
+                                         * at a time and reads axis ranges from the device      */
+    SHARED = 1 << 6,                    /* Linux only, combined with the above. All hooks with
+                                         * this flag open, read and discover each device once
+                                         * and every one of them gets its input                 */
     NATIVE_DEFAULT = (JS | XINPUT),     /* Use default hooking, Xinput on windows, JS on linux  */
 };
 }
+
+/* What happens to the input a device queued while it wasn't read */
+namespace resume_policy {
+enum type : uint8_t {
+    DRAIN,                              /* Applied to the device state, without any events  */
+    DISCARD                             /* Dropped, the state is the one from before        */
+};
+}
 /* clang-format on */
 
 extern void default_hook_thread(class hook* h);
@@ -73,17 +91,127 @@ protected:
     event_callback m_reconnect_handler;
 
     /* Map of previously connected devices, to ensure that no new instance
-     * is created on reconnection */
-    std::map<std::string, std::shared_ptr<device>> m_device_cache;
+     * is created on reconnection. Keyed by device::get_cache_id() */
+    std::unordered_map<std::string, std::shared_ptr<device>> m_device_cache;
 
     binding_map m_binding_map; /* Map device id to binding name */
 
+    /* Compiled default binding, devices without a custom binding
+     * get a clone of it, which shares its mapping table */
+    std::shared_ptr<cfg::binding> m_default_binding;
+
+    /* Lookup indexes for get_device_by_id and get_binding_by_name. They only
+     * hold weak references, so they don't show up in the reference counts
+     * that are checked when devices and bindings are closed */
+    std::unordered_map<std::string, std::weak_ptr<device>> m_device_index;
+    std::unordered_map<std::string, std::weak_ptr<cfg::binding>> m_binding_index;
+    size_t m_indexed_bindings = 0; /* Size of m_bindings when the index was last updated */
+    uint64_t m_indexed_renames = 0; /* cfg::binding::get_rename_count() when it was last rebuilt */
+    std::atomic<bool> m_bindings_exposed { false }; /* m_bindings was handed out for changes */
+    /* Lookups update the binding index, so it has its own lock */
+    std::mutex m_binding_index_mutex;
+
+    /* Adds a device to the device list or the cache and indexes it */
+    void add_device(const std::shared_ptr<device>& dev);
+    void cache_device(const std::shared_ptr<device>& dev);
+    std::shared_ptr<device> get_cached_device(const std::string& cache_id);
+
+    void index_binding(const std::shared_ptr<cfg::binding>& binding);
+    /* With m_binding_index_mutex held */
+    void rebuild_binding_index();
+    void rebuild_device_index();
+
     std::thread m_hook_thread;
     std::mutex m_mutex;
     std::atomic<bool> m_running;
-    bool m_plug_and_play = false;
-    ns m_plug_and_play_interval = ms(1000);
-    ns m_thread_sleep = ms(50);
+    /* Read by the hook and discovery threads, changes are announced with a control */
+    std::atomic<bool> m_plug_and_play { false };
+    std::atomic<ns> m_plug_and_play_interval { ms(1000) };
+    std::atomic<ns> m_thread_sleep { ms(50) };
+    std::atomic<bool> m_paused { false };
+    std::atomic<bool> m_lazy_open { false };
+    std::atomic<ns> m_lazy_idle_period { ms(5000) };
+
+    /* Platforms that probe devices on their own thread hand them over here,
+     * it's called by the hook thread on every iteration without the mutex */
+    virtual void adopt_devices() { }
+
+    /* True if plug and play doesn't need query_devices on the hook thread */
+    virtual bool discovers_async() const { return false; }
+
+    /* Reads the input of one device and calls the event handlers, with its input mutex held.
+     * Stops after max_events updates that changed something, returns how many did */
+    int update_device(const std::shared_ptr<device>& dev, int max_events = std::numeric_limits<int>::max());
+
+    /* Called by the hook thread between iterations without the mutex, returns early
+     * once a control was posted. Platforms that can wait for input on their devices
+     * also return once one has some. ns::max() waits for a control only. Returns
+     * true if it returned early */
+    virtual bool wait_for_input(ns timeout);
+
+    /* Latency mode, the hook thread polls instead of sleeping for the last
+     * m_spin_budget before each deadline and after input, see set_spin_budget */
+    std::atomic<ns> m_spin_budget { ns(0) };
+    std::atomic<uint64_t> m_spin_cpu_time { 0 }, m_spin_wall_time { 0 };
+    std::atomic<uint64_t> m_spin_windows { 0 }, m_spin_hits { 0 };
+
+    /* Checks for input or a control without blocking, called while spinning.
+     * The base version only sees controls, devices are read at the deadline */
+    virtual bool poll_input();
+    /* Called before the hook thread spins, platforms get their devices ready for
+     * poll_input here. False if spinning can't help, e.g. input is dispatched by
+     * other threads */
+    virtual bool start_spin() { return true; }
+    /* wait_for_input with the spin budget applied, the devices are polled
+     * right away until spin_until, which is set after input was handled */
+    void wait_spinning(ns timeout, std::chrono::steady_clock::time_point spin_until);
+    /* Polls until input, a control or end, returns true if it didn't reach end */
+    bool spin_for_input(std::chrono::steady_clock::time_point end);
+
+    /* Requests for the hook thread. They're queued by other threads and applied
+     * at the start of the next iteration, posting one wakes the thread up */
+    struct control {
+        enum type : uint8_t {
+            STOP,
+            SLEEP_TIME, /* m_thread_sleep or m_spin_budget changed */
+            PLUG_AND_PLAY, /* m_plug_and_play or its interval changed */
+            PAUSE,
+            RESUME,
+            RESCAN, /* Probe the devices even if nothing seems to have changed */
+            DEVICES, /* A device was enabled or disabled */
+            LAZY_OPEN /* m_lazy_open or its idle period changed */
+        };
+        type kind;
+    };
+    std::mutex m_control_mutex;
+    std::condition_variable m_control_cv;
+    std::vector<control> m_controls;
+
+    /* Queues a control if the hook thread runs or the hook is pumped, returns false otherwise */
+    bool post_control(control::type kind);
+    /* Applies the queued controls, returns false once the hook thread should end */
+    bool apply_controls();
+    virtual void apply_control(const control& c);
+    /* Interrupts wait_for_input, platforms that wait on something else than m_control_cv override it */
+    virtual void wake_hook_thread() { m_control_cv.notify_all(); }
+
+    /* Brings a device up to date after it wasn't read for a while, see resume_policy */
+    std::atomic<uint8_t> m_resume_policy { resume_policy::DRAIN };
+    virtual void catch_up(const std::shared_ptr<device>& dev);
+    /* Starts or stops reading a device, with the mutex and its input mutex held */
+    virtual void apply_enabled(const std::shared_ptr<device>& dev, bool enabled);
+
+    /* Set while the hook is driven by pump() instead of the hook thread */
+    std::atomic<bool> m_pumped { false };
+    size_t m_pump_next = 0; /* Device the next pump() starts with, so one busy device can't starve the rest */
+    bool m_pump_backlog = false; /* The last pump() left input for the next one */
+    uint64_t m_pump_last_query = 0;
+
+    /* Set once the devices present at start were handed out, see wait_until_ready */
+    std::mutex m_ready_mutex;
+    std::condition_variable m_ready_cv;
+    bool m_ready = false;
+    void set_ready(bool ready);
 
     /* Can be used for platform specific bind options
      * Only used for DirectInput currently, which needs a sepcial hack
@@ -91,15 +219,24 @@ protected:
      */
 #ifdef LGP_ENABLE_JSON
     virtual void on_bind(json11::Json::object& j, uint16_t native_code, uint16_t vc, int16_t val, bool is_axis);
+
+    /* Builds binding instances and the device to binding map from json
+     * without touching any state of the hook */
+    bool compile_bindings(const json11::Json& j, bindings_list& bindings, binding_map& map);
 #endif
 
+    /* Replaces the binding with the same name or adds it if there is none,
+     * devices using the old instance are switched over to the new one */
+    void replace_binding(const std::shared_ptr<cfg::binding>& binding);
+
 public:
     hook();
     virtual ~hook() { hook::stop(); }
 
     /**
      * @brief get the hook thread mutex, use this to safely access
-     * input data
+     * input data. Devices read by io threads are only updated with
+     * their own mutex held, see device::get_input_mutex()
      * @return The hook mutex
      */
     std::mutex* get_mutex() { return &m_mutex; }
@@ -107,7 +244,7 @@ public:
     /**
      * @return Thread sleep time
      */
-    ms get_sleep_time() const { return std::chrono::duration_cast<std::chrono::milliseconds>(m_thread_sleep); }
+    ms get_sleep_time() const { return std::chrono::duration_cast<std::chrono::milliseconds>(m_thread_sleep.load()); }
 
     /**
      * @return true if the hook thread is running
@@ -122,8 +259,97 @@ public:
     template <class Rep, class Period>
     void set_plug_and_play(bool state, std::chrono::duration<Rep, Period> refresh_rate)
     {
+        const ns sleep = m_thread_sleep;
+        m_plug_and_play_interval = refresh_rate >= sleep ? ns(refresh_rate) : sleep;
         m_plug_and_play = state;
-        m_plug_and_play_interval = refresh_rate >= m_thread_sleep ? refresh_rate : m_thread_sleep;
+        post_control(control::PLUG_AND_PLAY);
+    }
+
+    /* Time the hook thread spent spinning, see set_spin_budget */
+    struct spin_stats {
+        ns cpu_time; /* CPU time used by the hook thread while spinning */
+        ns wall_time;
+        uint64_t windows; /* Times the hook thread started spinning */
+        uint64_t hits; /* Windows that ended with input or a control */
+    };
+
+    /**
+     * @brief Enables the latency mode. Short sleep times are overslept because of
+     * timer slack, so the hook thread only sleeps until budget before each deadline
+     * and polls the devices for the rest. After input it keeps polling for budget
+     * before it sleeps again. Costs up to budget of CPU time per iteration, zero
+     * turns it off
+     */
+    template <class Rep, class Period>
+    void set_spin_budget(std::chrono::duration<Rep, Period> budget)
+    {
+        m_spin_budget = budget;
+        post_control(control::SLEEP_TIME);
+    }
+    ns get_spin_budget() const { return m_spin_budget; }
+
+    /**
+     * @brief CPU time spent spinning so far, to weigh it against the latency gained
+     */
+    spin_stats get_spin_stats() const;
+    void reset_spin_stats();
+
+    /**
+     * @brief Stops reading the devices and calling the event handlers, devices and
+     * bindings stay open. The hook thread sleeps until resume() or stop()
+     */
+    void pause();
+    void resume();
+    bool paused() const { return m_paused; }
+
+    /**
+     * @brief Selects what happens to the input that was queued while the hook was
+     * paused or a device was disabled, once it's read again
+     */
+    void set_resume_policy(resume_policy::type policy) { m_resume_policy = policy; }
+    resume_policy::type get_resume_policy() const { return resume_policy::type(m_resume_policy.load()); }
+
+    /**
+     * @brief Enables or disables a single device, see device::set_enabled. Disabled
+     * devices aren't watched for input, their descriptor stays open
+     */
+    void set_device_enabled(const std::shared_ptr<device>& dev, bool enabled);
+
+    /**
+     * @brief Makes the hook thread probe the devices right away, even if plug and play
+     * is disabled or nothing seems to have changed
+     */
+    void rescan() { post_control(control::RESCAN); }
+
+    /**
+     * @brief Saves the known devices, their capabilities, the compiled bindings and
+     * the device to binding map, so the next start can skip querying and compiling them
+     * @param path The target path
+     * @return true on success, false if the platform doesn't support it
+     */
+    virtual bool save_warm_state(const std::string&) { return false; }
+
+    /**
+     * @brief Loads a state saved with save_warm_state, call it before start().
+     * Entries of devices that aren't attached as the same node anymore are discarded
+     * @param path The state file
+     * @return true on success, false if the file is missing, invalid or not supported
+     */
+    virtual bool load_warm_state(const std::string&) { return false; }
+
+    /**
+     * @brief Enable or disable lazy opening. Devices are still found and identified,
+     * but only opened while they're subscribed to or their state is read, and closed
+     * again once they weren't used for the idle period. Only supported on Linux
+     * @param state Enable or disable lazy opening
+     * @param idle_period Time after which an unused device is closed
+     */
+    template <class Rep, class Period>
+    void set_lazy_open(bool state, std::chrono::duration<Rep, Period> idle_period)
+    {
+        m_lazy_idle_period = idle_period;
+        m_lazy_open = state;
+        post_control(control::LAZY_OPEN);
     }
 
     /**
@@ -181,13 +407,43 @@ public:
 
 #ifdef LGP_ENABLE_JSON
     virtual bool load_bindings(const json11::Json& j);
+
+    /**
+     * @brief Replaces all bindings and the binding map with the ones in j.
+     * The new bindings are fully built before the hook mutex is taken, so
+     * the hook thread only waits for the pointers to be swapped
+     * @param j Json in the same format as used by save_bindings
+     * @return true on success
+     */
+    virtual bool reload_bindings(const json11::Json& j);
 #endif
+
+    /**
+     * @brief Reloads bindings from a file, see reload_bindings(const json11::Json&)
+     * @param path The bindings file
+     * @return true on success
+     */
+    bool reload_bindings(const std::string& path);
+
+    /**
+     * @brief Watch a bindings file and reload it every time it is written
+     * The reload happens on a separate thread, so input isn't stalled
+     * while the file is parsed
+     * @param path The bindings file
+     * @return true if the file is now being watched
+     */
+    virtual bool watch_bindings(const std::string& path);
+
+    /**
+     * @brief Stop watching the bindings file
+     */
+    virtual void unwatch_bindings();
+
     template <class Rep, class Period>
     void set_sleep_time(std::chrono::duration<Rep, Period> t)
     {
-        m_mutex.lock();
         m_thread_sleep = t;
-        m_mutex.unlock();
+        post_control(control::SLEEP_TIME);
     }
 
     virtual void remove_invalid_devices();
@@ -197,6 +453,46 @@ public:
     virtual bool start();
     virtual void stop();
 
+    /**
+     * @brief Starts the hook thread without waiting for the initial device query.
+     * Devices are reported through the connect event handler as they come up,
+     * platforms without concurrent discovery fall back to start()
+     * @return true on success
+     */
+    virtual bool start_async();
+
+    /**
+     * @brief Waits until the devices that were present at start are connected
+     * @param timeout Maximum time to wait
+     * @return true if the initial devices are ready
+     */
+    bool wait_until_ready(ns timeout);
+
+    /**
+     * @brief Starts the hook without the hook thread, for applications that have their
+     * own event loop. Devices are queried right away, after that input and device changes
+     * are only processed by pump(), on the thread that calls it
+     * @return true on success, false if the platform doesn't support it
+     */
+    virtual bool start_pump();
+
+    /**
+     * @brief Descriptor for poll(), epoll or an event loop, it becomes readable once a
+     * device has input or a device change is pending. Only valid after start_pump()
+     * @return The descriptor, or -1 if there is none
+     */
+    virtual int get_poll_fd() const { return -1; }
+
+    /**
+     * @brief Handles whatever input and device changes are ready without blocking
+     * @param max_events Maximum number of device updates that change something, the
+     * rest stays pending and the poll descriptor stays readable
+     * @return Number of updates that changed something
+     */
+    virtual int pump(int max_events = 64);
+
+    bool pumped() const { return m_pumped; }
+
 #ifdef LGP_ENABLE_JSON
     virtual std::shared_ptr<cfg::binding> make_native_binding(const json11::Json& j) = 0;
     virtual void make_xbox_config(const std::shared_ptr<gamepad::device>& dv, json11::Json& out);
@@ -205,12 +501,27 @@ public:
 
     virtual std::shared_ptr<cfg::binding> make_native_binding(const std::string& json = "");
 
+    /**
+     * @brief Creates a default binding for a device. The json is only compiled
+     * once, so this only costs an allocation and a reference count
+     * @return A new binding instance, which can be modified without affecting other devices
+     */
+    std::shared_ptr<cfg::binding> make_default_binding();
+
     std::shared_ptr<cfg::binding> get_binding_for_device(const std::string& id);
     std::shared_ptr<device> get_device_by_id(const std::string& id);
     std::shared_ptr<cfg::binding> get_binding_by_name(const std::string& name);
     const device_list& get_devices() const { return m_devices; }
     const bindings_list& get_bindings() const { return m_bindings; }
-    bindings_list& get_bindings() { return m_bindings; }
+
+    /* Prefer add_binding() for adding bindings, the binding index is rebuilt
+     * on the next lookup, changes made after that through the returned list
+     * need another call first */
+    bindings_list& get_bindings()
+    {
+        m_bindings_exposed = true;
+        return m_bindings;
+    }
 
     binding_map& get_binding_map() { return m_binding_map; }
     const binding_map& get_binding_map() const { return m_binding_map; }
@@ -222,6 +533,7 @@ public:
             existing_bind->copy(binding);
         } else {
             m_bindings.emplace_back(binding);
+            index_binding(binding);
         }
     }
 
@@ -4,7 +4,7 @@
  *
  * The core object provided by the library is json11::Json. A Json object represents any JSON
  * value: null, bool, number (int or double), string (std::string), array (std::vector), or
- * object (std::map).
+ * object (json11::object_map, a std::map-like sorted vector).
  *
  * Json objects act like values: they can be assigned, copied, moved, compared for equality or
  * order, etc. There are also helper methods Json::dump, to serialize a Json to a string, and
@@ -53,10 +53,15 @@
 #ifndef LGP_HAVE_JSON // Set when using libgamepad in projects that already have json11
 #ifdef LGP_ENABLE_JSON // Set when using libgamepad with json interface
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <initializer_list>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -80,6 +85,254 @@ enum JsonParse {
 
 class JsonValue;
 
+/* Storage for JSON objects: key/value pairs in a vector sorted by key, with the
+ * parts of the std::map interface json11 users rely on. Objects are small and
+ * mostly read, so a binary search over contiguous pairs beats walking a tree,
+ * and keys can be looked up from a (pointer, length) without building a
+ * std::string. Keys use std::string's small string buffer, so the usual short
+ * keys don't allocate either. It's a template only so that Json can be
+ * incomplete where Json::object is declared.
+ *
+ * Unlike std::map, inserting or erasing invalidates all iterators and
+ * references, there's no lower_bound, equal_range or node handles, and the
+ * iterators hand out proxies, so loops take entries as const auto& or auto.
+ */
+template <class V>
+class object_map {
+public:
+    typedef std::string key_type;
+    typedef V mapped_type;
+    typedef std::pair<const std::string, V> value_type;
+    /* Entries are stored with a mutable key, so the vector can move them around */
+    typedef std::vector<std::pair<std::string, V>> storage;
+    typedef typename storage::size_type size_type;
+
+private:
+    typedef typename storage::value_type entry;
+
+public:
+    /* What the iterators hand out instead of a value_type&, the key is const
+     * like std::map's, so the sort order can't be broken through it. It refers
+     * to the stored entry, which has a mutable key so the vector can shift it */
+    template <class T>
+    struct basic_reference {
+        const std::string& first;
+        T& second;
+
+        operator std::pair<std::string, typename std::remove_const<T>::type>() const { return { first, second }; }
+    };
+
+private:
+    /* Random access iterator over the entries, a proxy iterator like the one
+     * of std::vector<bool>: *it is a basic_reference by value */
+    template <class E, class T>
+    class basic_iterator {
+        E* m_entry = nullptr;
+        friend class object_map;
+
+        struct arrow {
+            basic_reference<T> ref;
+            const basic_reference<T>* operator->() const { return &ref; }
+        };
+
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef typename object_map::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef arrow pointer;
+        typedef basic_reference<T> reference;
+
+        basic_iterator() { }
+        explicit basic_iterator(E* e)
+            : m_entry(e)
+        {
+        }
+        /* iterator converts to const_iterator */
+        template <class E2, class T2>
+        basic_iterator(const basic_iterator<E2, T2>& other)
+            : m_entry(other.m_entry)
+        {
+        }
+
+        reference operator*() const { return reference { m_entry->first, m_entry->second }; }
+        pointer operator->() const { return pointer { **this }; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        basic_iterator& operator++()
+        {
+            ++m_entry;
+            return *this;
+        }
+        basic_iterator& operator--()
+        {
+            --m_entry;
+            return *this;
+        }
+        basic_iterator operator++(int) { return basic_iterator(m_entry++); }
+        basic_iterator operator--(int) { return basic_iterator(m_entry--); }
+        basic_iterator& operator+=(difference_type n)
+        {
+            m_entry += n;
+            return *this;
+        }
+        basic_iterator& operator-=(difference_type n)
+        {
+            m_entry -= n;
+            return *this;
+        }
+        basic_iterator operator+(difference_type n) const { return basic_iterator(m_entry + n); }
+        basic_iterator operator-(difference_type n) const { return basic_iterator(m_entry - n); }
+        friend basic_iterator operator+(difference_type n, const basic_iterator& it) { return it + n; }
+
+        template <class E2, class T2>
+        difference_type operator-(const basic_iterator<E2, T2>& o) const { return m_entry - o.m_entry; }
+        template <class E2, class T2>
+        bool operator==(const basic_iterator<E2, T2>& o) const { return m_entry == o.m_entry; }
+        template <class E2, class T2>
+        bool operator!=(const basic_iterator<E2, T2>& o) const { return m_entry != o.m_entry; }
+        template <class E2, class T2>
+        bool operator<(const basic_iterator<E2, T2>& o) const { return m_entry < o.m_entry; }
+        template <class E2, class T2>
+        bool operator>(const basic_iterator<E2, T2>& o) const { return m_entry > o.m_entry; }
+        template <class E2, class T2>
+        bool operator<=(const basic_iterator<E2, T2>& o) const { return m_entry <= o.m_entry; }
+        template <class E2, class T2>
+        bool operator>=(const basic_iterator<E2, T2>& o) const { return m_entry >= o.m_entry; }
+
+        template <class E2, class T2>
+        friend class basic_iterator;
+    };
+
+public:
+    typedef basic_iterator<entry, V> iterator;
+    typedef basic_iterator<const entry, const V> const_iterator;
+
+    object_map() { }
+    object_map(std::initializer_list<value_type> items)
+        : m_items(items.begin(), items.end())
+    {
+        normalize();
+    }
+    template <class It>
+    object_map(It first, It last)
+        : m_items(first, last)
+    {
+        normalize();
+    }
+    /* Takes pairs in any order, for duplicate keys the last one wins */
+    explicit object_map(storage&& items)
+        : m_items(std::move(items))
+    {
+        normalize();
+    }
+
+    iterator begin() { return iterator(m_items.data()); }
+    iterator end() { return iterator(m_items.data() + m_items.size()); }
+    const_iterator begin() const { return const_iterator(m_items.data()); }
+    const_iterator end() const { return const_iterator(m_items.data() + m_items.size()); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    size_type size() const { return m_items.size(); }
+    bool empty() const { return m_items.empty(); }
+    void clear() { m_items.clear(); }
+    void reserve(size_type n) { m_items.reserve(n); }
+
+    const_iterator find(const char* key, size_t length) const
+    {
+        auto it = lower_bound(key, length);
+        return it != m_items.end() && compare(it->first, key, length) == 0 ? wrap(it) : end();
+    }
+    iterator find(const char* key, size_t length)
+    {
+        auto it = lower_bound(key, length);
+        return it != m_items.end() && compare(it->first, key, length) == 0 ? wrap(it) : end();
+    }
+    const_iterator find(const std::string& key) const { return find(key.data(), key.size()); }
+    iterator find(const std::string& key) { return find(key.data(), key.size()); }
+    size_type count(const std::string& key) const { return find(key) != end(); }
+
+    V& operator[](const std::string& key) { return emplace(key, V()).first->second; }
+    V& operator[](std::string&& key) { return emplace(std::move(key), V()).first->second; }
+
+    /* Inserts unless the key exists, like std::map::emplace */
+    template <class K, class T>
+    std::pair<iterator, bool> emplace(K&& key, T&& value)
+    {
+        const std::string& k = key;
+        auto it = lower_bound(k.data(), k.size());
+        if (it != m_items.end() && it->first == k)
+            return { wrap(it), false };
+        return { wrap(m_items.emplace(it, std::forward<K>(key), std::forward<T>(value))), true };
+    }
+    std::pair<iterator, bool> insert(const value_type& item) { return emplace(item.first, item.second); }
+    std::pair<iterator, bool> insert(value_type&& item) { return emplace(item.first, std::move(item.second)); }
+
+    iterator erase(const_iterator it) { return wrap(m_items.erase(m_items.begin() + (it - cbegin()))); }
+    size_type erase(const std::string& key)
+    {
+        auto it = lower_bound(key.data(), key.size());
+        if (it == m_items.end() || it->first != key)
+            return 0;
+        m_items.erase(it);
+        return 1;
+    }
+
+    bool operator==(const object_map& rhs) const { return m_items == rhs.m_items; }
+    bool operator!=(const object_map& rhs) const { return m_items != rhs.m_items; }
+    bool operator<(const object_map& rhs) const { return m_items < rhs.m_items; }
+
+private:
+    storage m_items;
+
+    static int compare(const std::string& a, const char* b, size_t length)
+    {
+        return a.compare(0, std::string::npos, b, length);
+    }
+
+    iterator wrap(typename storage::iterator it) { return iterator(m_items.data() + (it - m_items.begin())); }
+    const_iterator wrap(typename storage::const_iterator it) const
+    {
+        return const_iterator(m_items.data() + (it - m_items.begin()));
+    }
+
+    typename storage::iterator lower_bound(const char* key, size_t length)
+    {
+        return std::lower_bound(m_items.begin(), m_items.end(), key,
+            [length](const entry& item, const char* k) { return compare(item.first, k, length) < 0; });
+    }
+    typename storage::const_iterator lower_bound(const char* key, size_t length) const
+    {
+        return std::lower_bound(m_items.begin(), m_items.end(), key,
+            [length](const entry& item, const char* k) { return compare(item.first, k, length) < 0; });
+    }
+
+    void normalize()
+    {
+        /* Parsed and dumped objects are already sorted, so check that first */
+        bool sorted = true;
+        for (size_type i = 1; i < m_items.size() && sorted; i++)
+            sorted = m_items[i - 1].first < m_items[i].first;
+        if (sorted)
+            return;
+
+        std::stable_sort(m_items.begin(), m_items.end(),
+            [](const entry& a, const entry& b) { return a.first < b.first; });
+
+        /* Keep the last of each run of equal keys, like repeated std::map assignments */
+        auto out = m_items.begin();
+        for (auto it = m_items.begin(); it != m_items.end(); ++it) {
+            auto next = it + 1;
+            if (next != m_items.end() && next->first == it->first)
+                continue;
+            if (out != it)
+                *out = std::move(*it);
+            ++out;
+        }
+        m_items.erase(out, m_items.end());
+    }
+};
+
 class Json final {
 public:
     // Types
@@ -94,7 +347,7 @@ public:
 
     // Array and object typedefs
     typedef std::vector<Json> array;
-    typedef std::map<std::string, Json> object;
+    typedef object_map<Json> object;
 
     // Constructors for the various types of JSON value.
     Json() noexcept; // NUL
@@ -157,13 +410,22 @@ public:
     const std::string& string_value() const;
     // Return the enclosed std::vector if this is an array, or an empty vector otherwise.
     const array& array_items() const;
-    // Return the enclosed std::map if this is an object, or an empty map otherwise.
+    // Return the enclosed object_map if this is an object, or an empty map otherwise.
     const object& object_items() const;
 
     // Return a reference to arr[i] if this is an array, Json() otherwise.
     const Json& operator[](size_t i) const;
     // Return a reference to obj[key] if this is an object, Json() otherwise.
     const Json& operator[](const std::string& key) const;
+    // Same for string literals, without building a std::string for the key. This is
+    // a template so that j[0] still picks the array overload.
+    template <size_t N>
+    const Json& operator[](const char (&key)[N]) const
+    {
+        return get(key, strlen(key));
+    }
+    // Same for a key that isn't null terminated or a std::string.
+    const Json& get(const char* key, size_t length) const;
 
     // Serialize.
     void dump(std::string& out) const;
@@ -242,6 +504,7 @@ protected:
     virtual const Json& operator[](size_t i) const;
     virtual const Json::object& object_items() const;
     virtual const Json& operator[](const std::string& key) const;
+    virtual const Json& get(const char* key, size_t length) const;
     virtual ~JsonValue() { }
 };
 
@@ -131,6 +131,139 @@ namespace defaults {
                                   "}"
                                   "]}";
 
+    /* Codes are evdev key and abs codes, hats are reported as BTN_DPAD_*,
+     * BTN_TRIGGER_HAPPY1-4 is the dpad of xpad pads with dpad_to_buttons */
+    const char* evdev_bind_json = "{"
+                                  "\"name\": \"Default evdev binding\","
+                                  "\"binds\":"
+                                  "["
+                                  "{"
+                                  "    \"from\": 304,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60416"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 305,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60417"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 307,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60418"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 308,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60419"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 310,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60420"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 311,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60421"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 314,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60422"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 315,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60423"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 316,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60424"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 317,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60425"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 318,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60426"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 546,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60427"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 547,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60428"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 704,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60427"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 705,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60428"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 706,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60429"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 707,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60430"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 544,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60429"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 545,"
+                                  "    \"is_axis\": false,"
+                                  "    \"to\": 60430"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 0,"
+                                  "    \"is_axis\": true,"
+                                  "    \"to\": 60431"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 1,"
+                                  "    \"is_axis\": true,"
+                                  "    \"to\": 60432"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 2,"
+                                  "    \"is_axis\": true,"
+                                  "    \"to\": 60433"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 3,"
+                                  "    \"is_axis\": true,"
+                                  "    \"to\": 60434"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 4,"
+                                  "    \"is_axis\": true,"
+                                  "    \"to\": 60435"
+                                  "},"
+                                  "{"
+                                  "    \"from\": 5,"
+                                  "    \"is_axis\": true,"
+                                  "    \"to\": 60436"
+                                  "}"
+                                  "]}";
+
     const char* dinput_bind_json = "{"
                                    "\"name\": \"Default DirectInput binding\","
                                    "\"binds\": ["
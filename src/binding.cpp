@@ -16,49 +16,198 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include <algorithm>
+#include <atomic>
 #include <gamepad/binding.hpp>
 #include <gamepad/log.hpp>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 using namespace json11;
 
 namespace gamepad {
 namespace cfg {
+    size_t mapping_table::hash() const
+    {
+        /* FNV-1a over all pairs, the axis mappings are salted so a binding doesn't
+         * collide with one that has the same pairs as buttons */
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](uint64_t v) {
+            h ^= v;
+            h *= 1099511628211ull;
+        };
+
+        for (const auto& m : buttons)
+            mix(uint64_t(m.first) << 16 | m.second);
+        for (const auto& m : axis)
+            mix(uint64_t(1) << 32 | uint64_t(m.first) << 16 | m.second);
+        return size_t(h);
+    }
+
+    namespace {
+        /* The pool only holds weak references, tables are freed once the last
+         * binding using them is gone and take their entry with them. It's never
+         * destroyed, so tables can outlive static destruction */
+        struct table_pool {
+            std::mutex mutex;
+            std::unordered_map<size_t, std::vector<std::weak_ptr<const mapping_table>>> buckets;
+        };
+
+        table_pool& pool()
+        {
+            static auto* instance = new table_pool;
+            return *instance;
+        }
+
+        struct table_deleter {
+            size_t hash;
+
+            void operator()(const mapping_table* table) const
+            {
+                delete table;
+                auto& p = pool();
+                std::lock_guard<std::mutex> lock(p.mutex);
+                auto bucket = p.buckets.find(hash);
+                if (bucket == p.buckets.end())
+                    return;
+                auto& entries = bucket->second;
+                entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                  [](const std::weak_ptr<const mapping_table>& w) { return w.expired(); }),
+                    entries.end());
+                if (entries.empty())
+                    p.buckets.erase(bucket);
+            }
+        };
+    }
+
+    std::shared_ptr<const mapping_table> mapping_table::intern(mapping_table&& table)
+    {
+        const auto h = table.hash();
+        auto& p = pool();
+
+        /* Declared before the lock, so a table that expires while it's checked
+         * is only released, and taken out of the pool, after it was unlocked */
+        std::shared_ptr<const mapping_table> existing;
+        std::lock_guard<std::mutex> lock(p.mutex);
+        auto& bucket = p.buckets[h];
+
+        for (const auto& entry : bucket) {
+            existing = entry.lock();
+            if (existing && *existing == table)
+                return existing;
+        }
+
+        std::shared_ptr<const mapping_table> result(new mapping_table(std::move(table)), table_deleter { h });
+        bucket.emplace_back(result);
+        return result;
+    }
+
+    binding::binding()
+        : m_table(mapping_table::intern(mapping_table()))
+    {
+    }
+
+    binding::binding(const binding& other)
+        : m_binding_name(other.m_binding_name)
+        , m_table(other.share_table())
+    {
+    }
+
+    binding& binding::operator=(const binding& other)
+    {
+        set_name(other.m_binding_name);
+        set_table(other.share_table());
+        return *this;
+    }
 
     binding::binding(const std::string& json)
+        : binding()
     {
         binding::load(json);
     }
 
     binding::binding(const Json& j)
+        : binding()
     {
         binding::load(j);
     }
 
+    static std::atomic<uint64_t> rename_count { 0 };
+
+    void binding::set_name(const std::string& name)
+    {
+        if (m_indexed && name != m_binding_name)
+            rename_count++;
+        m_binding_name = name;
+    }
+
+    uint64_t binding::get_rename_count()
+    {
+        return rename_count;
+    }
+
+    void binding::set_table(std::shared_ptr<const mapping_table> table)
+    {
+        std::lock_guard<std::mutex> lock(m_table_mutex);
+        std::atomic_store(&m_table, std::move(table));
+        m_private = nullptr;
+    }
+
+    std::shared_ptr<const mapping_table> binding::share_table() const
+    {
+        /* An edited table keeps changing, so others get an interned copy */
+        std::lock_guard<std::mutex> lock(m_table_mutex);
+        if (m_private)
+            return mapping_table::intern(mapping_table(*m_private));
+        return get_table();
+    }
+
+    mapping_table& binding::edit()
+    {
+        std::lock_guard<std::mutex> lock(m_table_mutex);
+        if (!m_private) {
+            auto table = std::make_shared<mapping_table>(*get_table());
+            m_private = table.get();
+            std::atomic_store(&m_table, std::shared_ptr<const mapping_table>(std::move(table)));
+        }
+        return *m_private;
+    }
+
+    void binding::commit()
+    {
+        std::lock_guard<std::mutex> lock(m_table_mutex);
+        if (!m_private)
+            return;
+        std::atomic_store(&m_table, mapping_table::intern(mapping_table(*m_private)));
+        m_private = nullptr;
+    }
+
     void binding::copy(const std::shared_ptr<binding> other)
     {
-        m_axis_mappings = other->m_axis_mappings;
-        m_buttons_mappings = other->m_buttons_mappings;
-        m_binding_name = other->m_binding_name;
+        set_table(other->share_table());
+        set_name(other->m_binding_name);
     }
 
     bool binding::load(const Json& j)
     {
         bool result = false;
         if (j.is_object()) {
-            m_binding_name = j["name"].string_value();
-            auto arr = j["binds"];
+            set_name(j["name"].string_value());
+            const auto& arr = j["binds"];
 
             if (arr.is_array()) {
-                m_axis_mappings.clear();
-                m_buttons_mappings.clear();
+                mapping_table table;
 
                 for (const auto& val : arr.array_items()) {
+                    const auto from = val["from"].int_value(), to = val["to"].int_value();
                     if (val["is_axis"].bool_value()) {
-                        m_axis_mappings[val["from"].int_value()] = val["to"].int_value();
+                        table.axis[from] = to;
                     } else {
-                        m_buttons_mappings[val["from"].int_value()] = val["to"].int_value();
+                        table.buttons[from] = to;
                     }
                 }
+                set_table(mapping_table::intern(std::move(table)));
                 result = true;
             } else {
                 gerr("Expected json array when loading gamepad bindings");
@@ -75,12 +224,13 @@ namespace cfg {
         Json arr;
         std::vector<Json> binds;
 
-        for (const auto& val : m_axis_mappings) {
+        const auto table = get_table();
+        for (const auto& val : table->axis) {
             Json obj = Json::object { { "is_axis", true }, { "from", val.first }, { "to", val.second } };
             binds.emplace_back(obj);
         }
 
-        for (const auto& val : m_buttons_mappings) {
+        for (const auto& val : table->buttons) {
             Json obj = Json::object { { "is_axis", false }, { "from", val.first }, { "to", val.second } };
             binds.emplace_back(obj);
         }
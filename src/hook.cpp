@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <ctime>
 #include <fstream>
 #include <gamepad/hook-dinput.hpp>
 #include <gamepad/hook-linux.hpp>
@@ -53,43 +54,335 @@ vector<tuple<string, uint16_t>> hook::axis_prompts = { { "left analog stick hori
     { "right analog vertically", axis::RIGHT_STICK_Y },
     { "right trigger", axis::RIGHT_TRIGGER } };
 
+/* Updates per device and loop iteration while it has pending input */
+static const int max_update_rounds = 256;
+
 void default_hook_thread(hook* h)
 {
-    auto sleep_time = h->m_thread_sleep;
-
     h->get_mutex()->lock();
     ginfo("Hook thread started");
     h->get_mutex()->unlock();
 
     auto plug_n_play_wait = ns(0);
-    while (h->running()) {
+    auto spin_until = chrono::steady_clock::time_point();
+    while (h->running() && h->apply_controls()) {
+        if (h->m_paused) {
+            /* Nothing is read or dispatched until the next control */
+            h->wait_for_input(ns::max());
+            continue;
+        }
+
+        const ns sleep_time = h->m_thread_sleep;
+        h->adopt_devices();
+
         if (!h->get_devices().empty()) {
+            int events = 0;
             h->get_mutex()->lock();
             for (const auto& dev : h->get_devices()) {
-                const auto result = dev->update();
-                if (result & update_result::AXIS && h->m_axis_handler)
-                    h->m_axis_handler(dev);
-                if (result & update_result::BUTTON && h->m_button_handler)
-                    h->m_button_handler(dev);
+                if (!dev->is_read_enabled())
+                    continue;
+                std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+                events += h->update_device(dev);
             }
-            sleep_time = h->m_thread_sleep;
-
             h->get_mutex()->unlock();
+            if (events > 0)
+                spin_until = chrono::steady_clock::now() + h->m_spin_budget.load();
         }
 
-        if (h->m_plug_and_play) {
-            if (plug_n_play_wait >= h->m_plug_and_play_interval) {
+        if (h->m_plug_and_play && !h->discovers_async()) {
+            if (plug_n_play_wait >= h->m_plug_and_play_interval.load()) {
                 plug_n_play_wait = ns(0);
                 gdebug("Updating device list");
                 h->query_devices();
             }
             plug_n_play_wait += sleep_time;
         }
-        this_thread::sleep_for(sleep_time);
+        h->wait_spinning(sleep_time, spin_until);
     }
     ginfo("Hook thread ended");
 }
 
+int hook::update_device(const std::shared_ptr<device>& dev, int max_events)
+{
+    /* Input the device already read is handled right away, but
+     * bounded, so one busy device can't stall the others */
+    int rounds = 0, events = 0;
+    do {
+        const auto result = dev->update();
+        if (result & update_result::AXIS && m_axis_handler)
+            m_axis_handler(dev);
+        if (result & update_result::BUTTON && m_button_handler)
+            m_button_handler(dev);
+        events += result != update_result::NONE;
+    } while (dev->has_pending() && events < max_events && ++rounds < max_update_rounds);
+    return events;
+}
+
+bool hook::post_control(control::type kind)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_control_mutex);
+        if (!m_running && !m_pumped)
+            return false;
+        m_controls.push_back({ kind });
+    }
+    wake_hook_thread();
+    return true;
+}
+
+bool hook::apply_controls()
+{
+    std::vector<control> controls;
+    {
+        std::lock_guard<std::mutex> lock(m_control_mutex);
+        controls.swap(m_controls);
+    }
+
+    for (const auto& c : controls) {
+        if (c.kind == control::STOP)
+            return false;
+        apply_control(c);
+    }
+    return true;
+}
+
+void hook::apply_control(const control& c)
+{
+    /* The sleep time, plug and play and lazy open settings are read on every iteration */
+    switch (c.kind) {
+    case control::PAUSE: {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_paused = true;
+        break;
+    }
+    case control::RESUME: {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_paused = false;
+        for (const auto& dev : m_devices) {
+            std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+            if (dev->is_read_enabled())
+                catch_up(dev);
+        }
+        break;
+    }
+    case control::DEVICES: {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& dev : m_devices) {
+            std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+            if (dev->is_enabled() != dev->is_read_enabled())
+                apply_enabled(dev, dev->is_enabled());
+        }
+        break;
+    }
+    case control::RESCAN:
+        query_devices();
+        break;
+    default:
+        break;
+    }
+}
+
+bool hook::wait_for_input(ns timeout)
+{
+    std::unique_lock<std::mutex> lock(m_control_mutex);
+    auto posted = [this] { return !m_controls.empty(); };
+    if (timeout == ns::max()) {
+        m_control_cv.wait(lock, posted);
+        return true;
+    }
+    return m_control_cv.wait_for(lock, timeout, posted);
+}
+
+bool hook::poll_input()
+{
+    std::lock_guard<std::mutex> lock(m_control_mutex);
+    return !m_controls.empty();
+}
+
+/* Spins between two yields, so a thread sharing the core still gets to run */
+static const unsigned spin_yield_interval = 64;
+
+static inline void cpu_relax()
+{
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    this_thread::yield();
+#endif
+}
+
+/* CPU time the calling thread used so far */
+static ns thread_cpu_time()
+{
+#if LGP_WINDOWS
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return ns(0);
+    auto ticks = [](const FILETIME& t) { return uint64_t(t.dwHighDateTime) << 32 | t.dwLowDateTime; };
+    return ns((ticks(kernel) + ticks(user)) * 100);
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return ns(0);
+    return ns(int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+#endif
+}
+
+bool hook::spin_for_input(chrono::steady_clock::time_point end)
+{
+    const auto cpu_start = thread_cpu_time();
+    const auto start = chrono::steady_clock::now();
+    bool hit = false;
+    auto now = start;
+    for (unsigned spins = 1; !(hit = poll_input()) && now < end; spins++) {
+        if (spins % spin_yield_interval == 0)
+            this_thread::yield();
+        else
+            cpu_relax();
+        now = chrono::steady_clock::now();
+    }
+
+    m_spin_cpu_time += uint64_t((thread_cpu_time() - cpu_start).count());
+    m_spin_wall_time += uint64_t(chrono::duration_cast<ns>(chrono::steady_clock::now() - start).count());
+    m_spin_windows++;
+    if (hit)
+        m_spin_hits++;
+    return hit;
+}
+
+void hook::wait_spinning(ns timeout, chrono::steady_clock::time_point spin_until)
+{
+    const ns budget = m_spin_budget;
+    if (budget <= ns(0) || timeout == ns::max() || !start_spin()) {
+        wait_for_input(timeout);
+        return;
+    }
+
+    auto now = chrono::steady_clock::now();
+    const auto deadline = now + timeout;
+    while (now < deadline) {
+        if (now >= spin_until) {
+            /* Sleeping through the whole timeout would overshoot it by the timer
+             * slack, so the thread wakes up budget early and polls from there */
+            if (deadline - now > budget && wait_for_input(deadline - now - budget))
+                return;
+            spin_until = deadline;
+        }
+        if (spin_for_input(min(deadline, spin_until)))
+            return;
+        now = chrono::steady_clock::now();
+    }
+}
+
+hook::spin_stats hook::get_spin_stats() const
+{
+    spin_stats stats;
+    stats.cpu_time = ns(m_spin_cpu_time.load());
+    stats.wall_time = ns(m_spin_wall_time.load());
+    stats.windows = m_spin_windows;
+    stats.hits = m_spin_hits;
+    return stats;
+}
+
+void hook::reset_spin_stats()
+{
+    m_spin_cpu_time = 0;
+    m_spin_wall_time = 0;
+    m_spin_windows = 0;
+    m_spin_hits = 0;
+}
+
+/* Bounds catching up on a device, kernel queues only hold a few hundred events */
+static const int max_drain_rounds = 4096;
+
+void hook::catch_up(const std::shared_ptr<device>& dev)
+{
+    if (m_resume_policy == resume_policy::DISCARD) {
+        dev->discard_input();
+        return;
+    }
+
+    /* Same as update_device, but without calling the handlers */
+    for (int rounds = 0; rounds < max_drain_rounds; rounds++) {
+        if (dev->update() == update_result::NONE && !dev->has_pending())
+            break;
+    }
+}
+
+void hook::apply_enabled(const std::shared_ptr<device>& dev, bool enabled)
+{
+    dev->set_read_enabled(enabled);
+    if (enabled && !m_paused)
+        catch_up(dev);
+}
+
+void hook::set_device_enabled(const std::shared_ptr<device>& dev, bool enabled)
+{
+    dev->set_enabled(enabled);
+    if (!post_control(control::DEVICES)) {
+        /* Nothing reads it while the hook isn't running */
+        std::lock_guard<std::mutex> lock(m_mutex);
+        dev->set_read_enabled(enabled);
+    }
+}
+
+void hook::pause()
+{
+    if (!post_control(control::PAUSE))
+        m_paused = true;
+}
+
+void hook::resume()
+{
+    if (!post_control(control::RESUME))
+        m_paused = false;
+}
+
+bool hook::start_pump()
+{
+    gerr("Pump mode isn't supported on this platform");
+    return false;
+}
+
+int hook::pump(int max_events)
+{
+    if (!m_pumped || !apply_controls() || m_paused)
+        return 0;
+
+    if (m_plug_and_play && !discovers_async()) {
+        const auto now = ms_ticks();
+        if (now - m_pump_last_query >= uint64_t(chrono::duration_cast<ms>(m_plug_and_play_interval.load()).count())) {
+            m_pump_last_query = now;
+            query_devices();
+        }
+    }
+    adopt_devices();
+    wait_for_input(ns(0));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto count = m_devices.size();
+    int events = 0;
+    size_t i = 0;
+    m_pump_backlog = false;
+    for (; i < count && events < max_events; i++) {
+        const auto& dev = m_devices[(m_pump_next + i) % count];
+        if (!dev->is_read_enabled())
+            continue;
+        std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+        events += update_device(dev, max_events - events);
+        m_pump_backlog = m_pump_backlog || dev->has_pending();
+    }
+
+    /* Devices that weren't reached might have input as well */
+    m_pump_backlog = m_pump_backlog || i < count;
+    m_pump_next = count ? (m_pump_next + i) % count : 0;
+    return events;
+}
+
 void hook::on_bind(Json::object&, uint16_t, uint16_t, int16_t, bool)
 {
     /* NO-OP */
@@ -139,6 +432,13 @@ std::shared_ptr<cfg::binding> hook::make_native_binding(const std::string& json)
     return nullptr;
 }
 
+std::shared_ptr<cfg::binding> hook::make_default_binding()
+{
+    if (!m_default_binding)
+        m_default_binding = make_native_binding(get_default_binding());
+    return m_default_binding ? m_default_binding->clone() : nullptr;
+}
+
 uint64_t hook::ms_ticks()
 {
     auto now = chrono::system_clock::now();
@@ -147,30 +447,67 @@ uint64_t hook::ms_ticks()
 
 std::shared_ptr<cfg::binding> hook::get_binding_for_device(const std::string& id)
 {
-    // Update the binding map, in case a device changed bindings
-    for (auto& dev : m_devices) {
-        // check if the device has a custom binding
-        if (!dev->has_binding())
-            continue;
-        auto bind_name = dev->get_binding()->get_name();
-        if (get_binding_by_name(bind_name)) {
-            auto bind = m_binding_map.find(dev->get_id());
-            if (bind != m_binding_map.end()) {
-                if (bind->second != bind_name)
-                    bind->second = bind_name;
-            }
-        }
+    /* m_binding_map is kept up to date by set_device_binding */
+    auto bind = m_binding_map.find(id);
+    if (bind != m_binding_map.end())
+        return get_binding_by_name(bind->second);
+    return nullptr;
+}
+
+void hook::add_device(const std::shared_ptr<device>& dev)
+{
+    m_devices.emplace_back(dev);
+    m_device_index[dev->get_id()] = dev;
+}
+
+void hook::cache_device(const std::shared_ptr<device>& dev)
+{
+    m_device_cache[dev->get_cache_id()] = dev;
+    m_device_index[dev->get_id()] = dev;
+}
+
+std::shared_ptr<device> hook::get_cached_device(const std::string& cache_id)
+{
+    auto it = m_device_cache.find(cache_id);
+    return it == m_device_cache.end() ? nullptr : it->second;
+}
+
+void hook::index_binding(const std::shared_ptr<cfg::binding>& binding)
+{
+    std::lock_guard<std::mutex> lock(m_binding_index_mutex);
+    binding->mark_indexed();
+    m_binding_index[binding->get_name()] = binding;
+    m_indexed_bindings = m_bindings.size();
+}
+
+void hook::rebuild_binding_index()
+{
+    m_binding_index.clear();
+    m_binding_index.reserve(m_bindings.size());
+    m_bindings_exposed = false;
+    m_indexed_renames = cfg::binding::get_rename_count();
+
+    /* Iterate backwards so the first binding with a name wins, like the linear search did */
+    for (auto it = m_bindings.rbegin(); it != m_bindings.rend(); ++it) {
+        (*it)->mark_indexed();
+        m_binding_index[(*it)->get_name()] = *it;
     }
+    m_indexed_bindings = m_bindings.size();
+}
 
-    auto bind = m_binding_map.find(id);
-    if (bind != m_binding_map.end()) {
-        auto result = find_if(m_bindings.begin(), m_bindings.end(),
-            [bind](shared_ptr<cfg::binding>& b) { return b->get_name() == bind->second; });
+void hook::rebuild_device_index()
+{
+    m_device_index.clear();
+    m_device_index.reserve(m_devices.size() + m_device_cache.size());
 
-        if (result != m_bindings.end())
-            return *result;
+    for (const auto& dev : m_devices)
+        m_device_index[dev->get_id()] = dev;
+
+    /* Cached instances take priority over the device list, like they did before */
+    for (const auto& entry : m_device_cache) {
+        if (entry.second)
+            m_device_index[entry.second->get_id()] = entry.second;
     }
-    return nullptr;
 }
 
 std::shared_ptr<hook> hook::make(uint16_t flags)
@@ -199,6 +536,7 @@ void hook::close_devices()
         }
     }
     m_devices.clear();
+    rebuild_device_index();
     m_mutex.unlock();
 }
 
@@ -214,6 +552,9 @@ void hook::close_bindings()
     }
 
     m_bindings.clear();
+    m_binding_index_mutex.lock();
+    rebuild_binding_index();
+    m_binding_index_mutex.unlock();
     m_mutex.unlock();
 }
 
@@ -221,8 +562,13 @@ bool hook::start()
 {
     if (m_running)
         return true;
+    if (m_pumped) {
+        gerr("The hook is already pumped, it can't start its thread");
+        return false;
+    }
 
     query_devices();
+    set_ready(true);
 
     if (m_devices.empty())
         ginfo("No Devices detected. Waiting for connection...");
@@ -231,14 +577,44 @@ bool hook::start()
     return true;
 }
 
+bool hook::start_async()
+{
+    return start();
+}
+
+void hook::set_ready(bool ready)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_ready_mutex);
+        m_ready = ready;
+    }
+    if (ready)
+        m_ready_cv.notify_all();
+}
+
+bool hook::wait_until_ready(ns timeout)
+{
+    std::unique_lock<std::mutex> lock(m_ready_mutex);
+    return m_ready_cv.wait_for(lock, timeout, [this] { return m_ready; });
+}
+
 void hook::stop()
 {
+    /* The control wakes the hook thread, so it doesn't finish its sleep first */
     if (m_running) {
+        post_control(control::STOP);
         m_running = false;
         m_hook_thread.join();
     }
+    {
+        std::lock_guard<std::mutex> lock(m_control_mutex);
+        m_controls.clear();
+        m_pumped = false;
+    }
+    m_paused = false;
     close_devices();
     close_bindings();
+    set_ready(false);
     gdebug("Hook stopped");
 }
 
@@ -297,23 +673,139 @@ bool hook::load_bindings(const std::string& path)
     return false;
 }
 
+bool hook::compile_bindings(const Json& j, bindings_list& bindings, binding_map& map)
+{
+    if (!j.is_object())
+        return false;
+
+    for (const auto& bind : j["bindings"].array_items()) {
+        auto b = make_native_binding(bind);
+        if (b)
+            bindings.emplace_back(b);
+    }
+
+    for (const auto& entry : j["bindings_map"].array_items())
+        map[entry["device_id"].string_value()] = entry["binding_id"].string_value();
+    return true;
+}
+
+void hook::replace_binding(const std::shared_ptr<cfg::binding>& binding)
+{
+    for (auto& existing : m_bindings) {
+        if (existing->get_name() != binding->get_name())
+            continue;
+
+        for (auto& dev : m_devices) {
+            if (dev->get_binding() == existing)
+                dev->set_binding(binding);
+        }
+        existing = binding;
+        index_binding(binding);
+        return;
+    }
+    m_bindings.emplace_back(binding);
+    index_binding(binding);
+}
+
 bool hook::load_bindings(const Json& j)
 {
-    Json bindings_map = j["bindings_map"], binding_array = j["bindings"];
+    bindings_list bindings;
+    binding_map map;
+
+    if (!compile_bindings(j, bindings, map))
+        return false;
 
-    for (const auto& bind : binding_array.array_items())
-        m_bindings.emplace_back(make_native_binding(bind));
+    for (const auto& bind : bindings)
+        replace_binding(bind);
 
-    for (const auto& entry : bindings_map.array_items()) {
-        auto device_id = entry["device_id"];
-        auto bind_id = entry["binding_id"];
-        m_binding_map[device_id.string_value()] = bind_id.string_value();
-        if (!set_device_binding(device_id.string_value(), bind_id.string_value()))
+    for (const auto& entry : map) {
+        m_binding_map[entry.first] = entry.second;
+        if (!set_device_binding(entry.first, entry.second))
             gwarn("Couldn't set binding.");
     }
     return true;
 }
 
+bool hook::reload_bindings(const std::string& path)
+{
+    std::ifstream in(path);
+
+    if (in.good()) {
+        std::string content = std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        std::string err;
+        auto j = Json::parse(content, err);
+
+        if (!err.empty()) {
+            gerr("Couldn't parse json when reloading bindings from '%s': %s", path.c_str(), err.c_str());
+            return false;
+        }
+        if (!reload_bindings(j)) {
+            gerr("Couldn't apply the bindings from '%s'", path.c_str());
+            return false;
+        }
+        ginfo("Reloaded bindings from '%s'", path.c_str());
+        return true;
+    }
+    gerr("Couldn't read bindings from '%s'", path.c_str());
+    return false;
+}
+
+bool hook::reload_bindings(const Json& j)
+{
+    bindings_list bindings;
+    binding_map map;
+
+    /* Everything that can take a while happens before the lock is taken */
+    if (!compile_bindings(j, bindings, map))
+        return false;
+    auto fallback = make_native_binding(get_default_binding());
+
+    auto find_new = [&bindings](const std::string& name) -> std::shared_ptr<cfg::binding> {
+        for (const auto& b : bindings) {
+            if (b->get_name() == name)
+                return b;
+        }
+        return nullptr;
+    };
+
+    m_mutex.lock();
+    for (auto& dev : m_devices) {
+        auto current = dev->get_binding();
+        std::shared_ptr<cfg::binding> next;
+        auto entry = map.find(dev->get_id());
+
+        if (entry != map.end())
+            next = find_new(entry->second);
+        if (!next && current)
+            next = find_new(current->get_name());
+
+        /* Devices that used a binding which no longer exists fall back to the default binding */
+        if (!next && current && get_binding_by_name(current->get_name()) == current)
+            next = fallback ? fallback->clone() : nullptr;
+
+        if (next)
+            dev->set_binding(next);
+    }
+    m_bindings.swap(bindings);
+    m_binding_map.swap(map);
+    m_binding_index_mutex.lock();
+    rebuild_binding_index();
+    m_binding_index_mutex.unlock();
+    m_mutex.unlock();
+    return true;
+}
+
+bool hook::watch_bindings(const std::string& path)
+{
+    gwarn("Watching '%s' isn't supported by this hook", path.c_str());
+    return false;
+}
+
+void hook::unwatch_bindings()
+{
+    /* NO-OP */
+}
+
 bool hook::set_device_binding(const std::string& device_id, const std::string& binding_id)
 {
     auto dev = get_device_by_id(device_id);
@@ -323,6 +815,7 @@ bool hook::set_device_binding(const std::string& device_id, const std::string& b
         auto bind = get_binding_by_name(binding_id);
         if (bind) {
             dev->set_binding(move(bind));
+            m_binding_map[device_id] = binding_id;
             result = true;
         } else {
             gwarn("No binding with name '%s'", binding_id.c_str());
@@ -336,31 +829,29 @@ bool hook::set_device_binding(const std::string& device_id, const std::string& b
 
 shared_ptr<device> hook::get_device_by_id(const std::string& id)
 {
-    auto result = find_if(m_device_cache.begin(), m_device_cache.end(),
-        [&id](pair<const string, shared_ptr<device>>& d) { return d.second->get_id() == id; });
-
-    if (result != m_device_cache.end())
-        return result->second;
-
-    /* Device isn't in cache, if it's in the normal device list, cache it and
-     * return it */
-    auto result2 = find_if(m_devices.begin(), m_devices.end(), [&id](shared_ptr<device>& d) { return d->get_id() == id; });
+    auto result = m_device_index.find(id);
+    if (result == m_device_index.end())
+        return nullptr;
 
-    if (result2 != m_devices.end()) {
-        m_device_cache[(*result2)->get_cache_id()] = *result2;
-        return *result2;
-    }
+    /* The id of a device can change after it was indexed, the index is
+     * rebuilt every time the device list is updated */
+    auto dev = result->second.lock();
+    if (dev && dev->get_id() == id)
+        return dev;
     return nullptr;
 }
 
 std::shared_ptr<cfg::binding> hook::get_binding_by_name(const std::string& name)
 {
-    auto result = find_if(m_bindings.begin(), m_bindings.end(),
-        [&name](shared_ptr<cfg::binding>& b) { return b->get_name() == name; });
-
-    if (result == m_bindings.end())
-        return nullptr;
-    return *result;
+    /* Indexed bindings that were renamed and lists that were handed out by
+     * get_bindings() invalidate the index, anything else keeps it up to date */
+    std::lock_guard<std::mutex> lock(m_binding_index_mutex);
+    if (m_bindings_exposed || m_bindings.size() != m_indexed_bindings
+        || m_indexed_renames != cfg::binding::get_rename_count())
+        rebuild_binding_index();
+
+    auto result = m_binding_index.find(name);
+    return result == m_binding_index.end() ? nullptr : result->second.lock();
 }
 
 void hook::make_xbox_config(const std::shared_ptr<gamepad::device>& dv, Json& out)
@@ -376,6 +867,9 @@ void hook::make_xbox_config(const std::shared_ptr<gamepad::device>& dv, Json& ou
     dv->set_axis_deadzone(axis::RIGHT_STICK_X, 500);
     dv->set_axis_deadzone(axis::RIGHT_STICK_Y, 500);
 
+    /* Every native input has to reach us, not only the ones the current binding uses */
+    dv->set_event_filter(false);
+
     ginfo("Starting config creation wizard");
     auto sleep_time = get_sleep_time();
     uint64_t last_key_input = 0;
@@ -444,6 +938,8 @@ void hook::make_xbox_config(const std::shared_ptr<gamepad::device>& dv, Json& ou
 
     out = Json::array(bind_array);
 
+    dv->set_event_filter(true);
+
     key_thread_mutex.lock();
     running = false;
     key_thread_mutex.unlock();
@@ -470,6 +966,7 @@ void hook::remove_invalid_devices()
             ++it;
         }
     }
+    rebuild_device_index();
 }
 
 }
@@ -24,16 +24,30 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <json/json11.hpp>
 #include <limits>
 
+#if !defined(JSON11_NO_SIMD)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JSON11_AVX2 1
+#define JSON11_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON11_SSE2 1
+#endif
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace json11 {
 
 static const int max_depth = 200;
 
 using std::initializer_list;
 using std::make_shared;
-using std::map;
 using std::move;
 using std::string;
 using std::vector;
@@ -56,22 +70,58 @@ static void dump(NullStruct, string& out)
     out += "null";
 }
 
+/* Writes the decimal digits of value to the end of buf and returns a pointer
+ * to the first digit, avoids snprintf for the common case of integers */
+static char* format_uint(uint64_t value, char* end)
+{
+    do {
+        *--end = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    return end;
+}
+
+static void dump_integer(int64_t value, string& out)
+{
+    char buf[24];
+    char* end = buf + sizeof buf;
+    /* Negate as unsigned, so INT64_MIN doesn't overflow */
+    auto magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    char* begin = format_uint(magnitude, end);
+    if (value < 0)
+        *--begin = '-';
+    out.append(begin, end);
+}
+
 static void dump(double value, string& out)
 {
-    if (std::isfinite(value)) {
-        char buf[32];
-        snprintf(buf, sizeof buf, "%.17g", value);
-        out += buf;
-    } else {
+    if (!std::isfinite(value)) {
         out += "null";
+        return;
+    }
+
+    /* Integral values are printed exactly without going through snprintf,
+     * 2^53 is the largest range in which every integer is representable */
+    static const double max_exact = 9007199254740992.0;
+    if (value == std::floor(value) && std::fabs(value) <= max_exact && !(value == 0 && std::signbit(value))) {
+        dump_integer(static_cast<int64_t>(value), out);
+        return;
     }
+
+    /* Shortest representation that parses back to the same value, most
+     * values round trip with 15 digits, 17 always do */
+    char buf[32];
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(buf, sizeof buf, "%.*g", precision, value);
+        if (precision == 17 || std::strtod(buf, nullptr) == value)
+            break;
+    }
+    out += buf;
 }
 
 static void dump(int value, string& out)
 {
-    char buf[32];
-    snprintf(buf, sizeof buf, "%d", value);
-    out += buf;
+    dump_integer(value, out);
 }
 
 static void dump(bool value, string& out)
@@ -79,11 +129,40 @@ static void dump(bool value, string& out)
     out += value ? "true" : "false";
 }
 
+/* Characters that end a run of bytes which can be copied without escaping,
+ * 0xe2 is the first byte of U+2028 and U+2029 which have to be escaped */
+struct EscapeTable {
+    bool stop[256];
+    EscapeTable()
+    {
+        for (int c = 0; c < 256; c++)
+            stop[c] = c <= 0x1f || c == '"' || c == '\\' || c == 0xe2;
+    }
+};
+
+static const EscapeTable escape_table;
+
 static void dump(const string& value, string& out)
 {
     out += '"';
-    for (size_t i = 0; i < value.length(); i++) {
-        const char ch = value[i];
+    const char* data = value.data();
+    const size_t length = value.length();
+    size_t run_start = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        const char ch = data[i];
+        if (!escape_table.stop[static_cast<uint8_t>(ch)])
+            continue;
+
+        if (static_cast<uint8_t>(ch) == 0xe2) {
+            /* Only U+2028 and U+2029 are escaped, anything else starting with 0xe2 is copied */
+            if (i + 2 >= length || static_cast<uint8_t>(data[i + 1]) != 0x80
+                || (static_cast<uint8_t>(data[i + 2]) != 0xa8 && static_cast<uint8_t>(data[i + 2]) != 0xa9))
+                continue;
+        }
+
+        out.append(data + run_start, i - run_start);
+
         if (ch == '\\') {
             out += "\\\\";
         } else if (ch == '"') {
@@ -99,21 +178,16 @@ static void dump(const string& value, string& out)
         } else if (ch == '\t') {
             out += "\\t";
         } else if (static_cast<uint8_t>(ch) <= 0x1f) {
-            char buf[8];
-            snprintf(buf, sizeof buf, "\\u%04x", ch);
-            out += buf;
-        } else if (static_cast<uint8_t>(ch) == 0xe2 && static_cast<uint8_t>(value[i + 1]) == 0x80
-            && static_cast<uint8_t>(value[i + 2]) == 0xa8) {
-            out += "\\u2028";
-            i += 2;
-        } else if (static_cast<uint8_t>(ch) == 0xe2 && static_cast<uint8_t>(value[i + 1]) == 0x80
-            && static_cast<uint8_t>(value[i + 2]) == 0xa9) {
-            out += "\\u2029";
-            i += 2;
+            static const char hex[] = "0123456789abcdef";
+            const char buf[6] = { '\\', 'u', '0', '0', hex[(ch >> 4) & 0xf], hex[ch & 0xf] };
+            out.append(buf, sizeof buf);
         } else {
-            out += ch;
+            out += static_cast<uint8_t>(data[i + 2]) == 0xa8 ? "\\u2028" : "\\u2029";
+            i += 2;
         }
+        run_start = i + 1;
     }
+    out.append(data + run_start, length - run_start);
     out += '"';
 }
 
@@ -145,8 +219,41 @@ static void dump(const Json::object& values, string& out)
     out += "}";
 }
 
+/* Estimate of the serialized size, so the output usually only has to be allocated
+ * once. Numbers with a fraction may need up to 24 bytes and are underestimated */
+static size_t estimate_size(const Json& value)
+{
+    switch (value.type()) {
+    case Json::NUMBER:
+        return std::fabs(value.number_value()) < 1e9 ? 11 : 24;
+    case Json::BOOL:
+        return 5;
+    case Json::STRING:
+        /* Most strings don't need escaping */
+        return value.string_value().size() + 2;
+    case Json::ARRAY: {
+        size_t size = 2;
+        for (const auto& item : value.array_items())
+            size += estimate_size(item) + 2;
+        return size;
+    }
+    case Json::OBJECT: {
+        size_t size = 2;
+        for (const auto& kv : value.object_items())
+            size += kv.first.size() + 4 + estimate_size(kv.second) + 2;
+        return size;
+    }
+    default:
+        return 4;
+    }
+}
+
 void Json::dump(string& out) const
 {
+    /* Nested values are dumped into a non-empty string, so this
+     * only happens once per document */
+    if (out.empty() && (is_array() || is_object()))
+        out.reserve(estimate_size(*this));
     m_ptr->dump(out);
 }
 
@@ -255,6 +362,7 @@ public:
 class JsonObject final : public Value<Json::OBJECT, Json::object> {
     const Json::object& object_items() const override { return m_value; }
     const Json& operator[](const string& key) const override;
+    const Json& get(const char* key, size_t length) const override;
 
 public:
     explicit JsonObject(const Json::object& value)
@@ -284,7 +392,7 @@ struct Statics {
     const std::shared_ptr<JsonValue> f = make_shared<JsonBoolean>(false);
     const string empty_string;
     const vector<Json> empty_vector;
-    const map<string, Json> empty_map;
+    const Json::object empty_map;
     Statics() { }
 };
 
@@ -364,24 +472,31 @@ int Json::int_value() const { return m_ptr->int_value(); }
 bool Json::bool_value() const { return m_ptr->bool_value(); }
 const string& Json::string_value() const { return m_ptr->string_value(); }
 const vector<Json>& Json::array_items() const { return m_ptr->array_items(); }
-const map<string, Json>& Json::object_items() const { return m_ptr->object_items(); }
+const Json::object& Json::object_items() const { return m_ptr->object_items(); }
 const Json& Json::operator[](size_t i) const { return (*m_ptr)[i]; }
 const Json& Json::operator[](const string& key) const { return (*m_ptr)[key]; }
+const Json& Json::get(const char* key, size_t length) const { return m_ptr->get(key, length); }
 
 double JsonValue::number_value() const { return 0; }
 int JsonValue::int_value() const { return 0; }
 bool JsonValue::bool_value() const { return false; }
 const string& JsonValue::string_value() const { return statics().empty_string; }
 const vector<Json>& JsonValue::array_items() const { return statics().empty_vector; }
-const map<string, Json>& JsonValue::object_items() const { return statics().empty_map; }
+const Json::object& JsonValue::object_items() const { return statics().empty_map; }
 const Json& JsonValue::operator[](size_t) const { return static_null(); }
 const Json& JsonValue::operator[](const string&) const { return static_null(); }
+const Json& JsonValue::get(const char*, size_t) const { return static_null(); }
 
 const Json& JsonObject::operator[](const string& key) const
 {
     auto iter = m_value.find(key);
     return (iter == m_value.end()) ? static_null() : iter->second;
 }
+const Json& JsonObject::get(const char* key, size_t length) const
+{
+    auto iter = m_value.find(key, length);
+    return (iter == m_value.end()) ? static_null() : iter->second;
+}
 const Json& JsonArray::operator[](size_t i) const
 {
     if (i >= m_value.size())
@@ -438,6 +553,163 @@ static inline bool in_range(long x, long lower, long upper)
     return (x >= lower && x <= upper);
 }
 
+/* * * * * * * * * * * * * * * * * * * *
+ * Scanning helpers for the parser
+ *
+ * Whitespace and plain string content make up most of a document, so
+ * they're skipped in blocks of 32 (AVX2), 16 (SSE2) or 8 (SWAR) bytes.
+ * The scalar loops handle the tails and platforms without SIMD. Block
+ * loads never read past the end of the input.
+ */
+
+static inline bool is_whitespace(char c)
+{
+    return c == ' ' || c == '\r' || c == '\n' || c == '\t';
+}
+
+/* Ends a run of string content that can be copied as is */
+static inline bool is_string_special(char c)
+{
+    return c == '"' || c == '\\' || static_cast<uint8_t>(c) <= 0x1f;
+}
+
+#ifdef JSON11_SSE2
+static inline int count_trailing_zeros(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline __m128i whitespace_mask(__m128i v)
+{
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+}
+
+static inline __m128i string_special_mask(__m128i v)
+{
+    /* Unsigned v <= 0x1f, there's no unsigned byte compare in SSE2 */
+    const __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+    return _mm_or_si128(control,
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+}
+#endif
+
+#ifdef JSON11_AVX2
+static inline __m256i whitespace_mask(__m256i v)
+{
+    return _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+}
+
+static inline __m256i string_special_mask(__m256i v)
+{
+    const __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+    return _mm256_or_si256(control,
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+}
+#endif
+
+#ifndef JSON11_SSE2
+/* SWAR: a byte in x is zero if its bit 7 is set in the result. The low 7 bits
+ * are added on their own, so no carry crosses into the next byte and every
+ * byte is tested exactly. The position is still found bytewise */
+static inline uint64_t swar_zero_bytes(uint64_t x)
+{
+    const uint64_t low = 0x7f7f7f7f7f7f7f7full;
+    return ~(((x & low) + low) | x | low);
+}
+
+static inline uint64_t swar_equal_bytes(uint64_t x, uint8_t c)
+{
+    return swar_zero_bytes(x ^ (0x0101010101010101ull * c));
+}
+
+/* Bytes below n, for 0 < n <= 0x80 */
+static inline uint64_t swar_less_bytes(uint64_t x, uint8_t n)
+{
+    const uint64_t low = 0x7f7f7f7f7f7f7f7full;
+    return ~(((x & low) + 0x0101010101010101ull * (0x80 - n)) | x) & 0x8080808080808080ull;
+}
+#endif
+
+/* Returns the index of the first non-whitespace character at or after i */
+static size_t skip_whitespace(const char* data, size_t i, size_t size)
+{
+    /* Most whitespace runs are a single space or a line break and indentation,
+     * so check the first character before setting up any block loads */
+    if (i >= size || !is_whitespace(data[i]))
+        return i;
+
+#if defined(JSON11_AVX2)
+    for (; i + 32 <= size; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(whitespace_mask(v)));
+        if (mask != 0xffffffffu)
+            return i + count_trailing_zeros(~mask);
+    }
+#endif
+#if defined(JSON11_SSE2)
+    for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(whitespace_mask(v)));
+        if (mask != 0xffff)
+            return i + count_trailing_zeros(~mask & 0xffff);
+    }
+#else
+    for (; i + 8 <= size; i += 8) {
+        uint64_t x;
+        memcpy(&x, data + i, sizeof(x));
+        /* All bytes whitespace means none of them differs from all four */
+        const uint64_t other = ~(swar_equal_bytes(x, ' ') | swar_equal_bytes(x, '\n') | swar_equal_bytes(x, '\r')
+                                   | swar_equal_bytes(x, '\t'))
+            & 0x8080808080808080ull;
+        if (other)
+            break;
+    }
+#endif
+    while (i < size && is_whitespace(data[i]))
+        i++;
+    return i;
+}
+
+/* Returns the index of the first quote, backslash or control character at or after i */
+static size_t find_string_special(const char* data, size_t i, size_t size)
+{
+#if defined(JSON11_AVX2)
+    for (; i + 32 <= size; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(string_special_mask(v)));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#endif
+#if defined(JSON11_SSE2)
+    for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(string_special_mask(v)));
+        if (mask)
+            return i + count_trailing_zeros(mask);
+    }
+#else
+    for (; i + 8 <= size; i += 8) {
+        uint64_t x;
+        memcpy(&x, data + i, sizeof(x));
+        if (swar_equal_bytes(x, '"') | swar_equal_bytes(x, '\\') | swar_less_bytes(x, 0x20))
+            break;
+    }
+#endif
+    while (i < size && !is_string_special(data[i]))
+        i++;
+    return i;
+}
+
 namespace {
     /* JsonParser
      *
@@ -477,8 +749,7 @@ namespace {
          */
         void consume_whitespace()
         {
-            while (str[i] == ' ' || str[i] == '\r' || str[i] == '\n' || str[i] == '\t')
-                i++;
+            i = skip_whitespace(str.data(), i, str.size());
         }
 
         /* consume_comment()
@@ -587,6 +858,15 @@ namespace {
             string out;
             long last_escaped_codepoint = -1;
             while (true) {
+                // The usual case: a run of non-escaped characters, copied in one go
+                const size_t run_end = find_string_special(str.data(), i, str.size());
+                if (run_end != i) {
+                    encode_utf8(last_escaped_codepoint, out);
+                    last_escaped_codepoint = -1;
+                    out.append(str, i, run_end - i);
+                    i = run_end;
+                }
+
                 if (i == str.size())
                     return fail("unexpected end of input in string", "");
 
@@ -600,14 +880,6 @@ namespace {
                 if (in_range(ch, 0, 0x1f))
                     return fail("unescaped " + esc(ch) + " in string", "");
 
-                // The usual case: non-escaped characters
-                if (ch != '\\') {
-                    encode_utf8(last_escaped_codepoint, out);
-                    last_escaped_codepoint = -1;
-                    out += ch;
-                    continue;
-                }
-
                 // Handle escapes
                 if (i == str.size())
                     return fail("unexpected end of input in string", "");
@@ -779,10 +1051,11 @@ namespace {
                 return parse_string();
 
             if (ch == '{') {
-                map<string, Json> data;
+                /* Collected in document order, Json::object sorts them once at the end */
+                Json::object::storage data;
                 ch = get_next_token();
                 if (ch == '}')
-                    return data;
+                    return Json::object();
 
                 while (1) {
                     if (ch != '"')
@@ -796,9 +1069,10 @@ namespace {
                     if (ch != ':')
                         return fail("expected ':' in object, got " + esc(ch));
 
-                    data[std::move(key)] = parse_json(depth + 1);
+                    Json value = parse_json(depth + 1);
                     if (failed)
                         return Json();
+                    data.emplace_back(std::move(key), std::move(value));
 
                     ch = get_next_token();
                     if (ch == '}')
@@ -808,7 +1082,7 @@ namespace {
 
                     ch = get_next_token();
                 }
-                return data;
+                return Json::object(std::move(data));
             }
 
             if (ch == '[') {
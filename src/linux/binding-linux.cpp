@@ -25,6 +25,7 @@ namespace gamepad {
 namespace cfg {
     static std::string default_error;
     Json linux_default_binding = Json::parse(gamepad::defaults::linux_bind_json, default_error);
+    Json evdev_default_binding = Json::parse(gamepad::defaults::evdev_bind_json, default_error);
 
     binding_linux::binding_linux(const std::string& json)
         : binding(json)
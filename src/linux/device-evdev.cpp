@@ -0,0 +1,389 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "device-evdev.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <gamepad/log.hpp>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace gamepad {
+
+/* Events read per read() call, a report from a gamepad is usually well below this */
+static const size_t EVDEV_BATCH_SIZE = 64;
+
+static const size_t BITS_PER_LONG = sizeof(unsigned long) * CHAR_BIT;
+#define EVDEV_LONGS(bits) ((bits + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline bool test_bit(const unsigned long* bits, size_t n)
+{
+    return (bits[n / BITS_PER_LONG] >> (n % BITS_PER_LONG)) & 1;
+}
+
+device_evdev::device_evdev(const std::string& path, bool open)
+    : device_node(path)
+{
+    m_absinfo.fill({});
+    if (open)
+        device_evdev::init();
+}
+
+device_evdev::~device_evdev()
+{
+    device_evdev::deinit();
+}
+
+bool device_evdev::is_gamepad(int fd)
+{
+    unsigned long keys[EVDEV_LONGS(KEY_CNT)] = {};
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0)
+        return false;
+    return test_bit(keys, BTN_GAMEPAD) || test_bit(keys, BTN_JOYSTICK);
+}
+
+bool device_evdev::on_open()
+{
+    if (m_caps_seeded) {
+        m_caps_seeded = false;
+    } else if (!is_gamepad(m_fd) || !read_capabilities()) {
+        gdebug("'%s' is not a gamepad", m_device_path.c_str());
+        return false;
+    }
+
+    /* Event timestamps default to the wall clock, which can jump */
+    int clock = CLOCK_MONOTONIC;
+    if (ioctl(m_fd, EVIOCSCLOCKID, &clock) < 0)
+        gwarn("Couldn't switch '%s' to monotonic timestamps", m_device_path.c_str());
+
+    char namebuffer[256] = {};
+    if (ioctl(m_fd, EVIOCGNAME(sizeof(namebuffer) - 1), namebuffer) != -1)
+        m_name = namebuffer;
+
+    int begin_idx = m_device_path.rfind('/');
+    std::string fd_name = m_device_path.substr(begin_idx + 1);
+    if (m_name.empty()) {
+        m_name = fd_name;
+        m_device_id = m_name;
+    } else {
+        m_device_id = "(" + fd_name + ") " + m_name;
+    }
+
+    /* Only allocated on the first open, a reconnect reuses the buffer */
+    m_read_buffer.resize(EVDEV_BATCH_SIZE);
+    m_read_pos = m_read_count = 0;
+    m_dropped = false;
+    m_mask_dirty = true;
+
+    /* Start with the current state instead of waiting for the first change */
+    m_needs_sync = true;
+    gdebug("Initialized evdev gamepad from '%s' with id '%s'", m_device_path.c_str(), m_device_id.c_str());
+    return true;
+}
+
+void device_evdev::on_close()
+{
+    m_pending.clear();
+    m_read_pos = m_read_count = 0;
+}
+
+bool device_evdev::read_capabilities()
+{
+    unsigned long keys[EVDEV_LONGS(KEY_CNT)] = {};
+    unsigned long abs[EVDEV_LONGS(ABS_CNT)] = {};
+
+    if (ioctl(m_fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0)
+        return false;
+    if (ioctl(m_fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs) < 0)
+        memset(abs, 0, sizeof(abs));
+
+    m_key_codes.clear();
+    m_abs_codes.clear();
+
+    for (uint16_t code = BTN_MISC; code < KEY_CNT; code++) {
+        if (test_bit(keys, code))
+            m_key_codes.emplace_back(code);
+    }
+
+    for (uint16_t code = 0; code < ABS_CNT; code++) {
+        if (test_bit(abs, code) && ioctl(m_fd, EVIOCGABS(code), &m_absinfo[code]) >= 0)
+            m_abs_codes.emplace_back(code);
+    }
+    return true;
+}
+
+void device_evdev::seed_capabilities(const std::vector<uint16_t>& key_codes,
+    const std::vector<std::pair<uint16_t, struct input_absinfo>>& abs)
+{
+    m_key_codes = key_codes;
+    m_abs_codes.clear();
+    for (const auto& a : abs) {
+        if (a.first >= ABS_CNT)
+            continue;
+        m_abs_codes.emplace_back(a.first);
+        m_absinfo[a.first] = a.second;
+    }
+    m_caps_seeded = true;
+}
+
+float device_evdev::normalize(uint16_t code, int32_t value) const
+{
+    const auto& info = m_absinfo[code];
+    if (info.maximum <= info.minimum)
+        return 0.f;
+    return fminf(1.f, fmaxf(0.f, float(value - info.minimum) / float(info.maximum - info.minimum)));
+}
+
+void device_evdev::stage(const struct ::input_event& e)
+{
+    if (e.type == EV_KEY) {
+        /* Key repeats don't change the state */
+        if (e.value != 2)
+            m_pending.push_back({ e.code, false, e.value });
+    } else if (e.type == EV_ABS) {
+        /* Hats are reported as axes, but they're the dpad, so they're
+         * turned into the dpad buttons some drivers report directly */
+        if (e.code == ABS_HAT0X) {
+            m_pending.push_back({ BTN_DPAD_LEFT, false, e.value < 0 });
+            m_pending.push_back({ BTN_DPAD_RIGHT, false, e.value > 0 });
+        } else if (e.code == ABS_HAT0Y) {
+            m_pending.push_back({ BTN_DPAD_UP, false, e.value < 0 });
+            m_pending.push_back({ BTN_DPAD_DOWN, false, e.value > 0 });
+        } else if (e.code < ABS_CNT) {
+            m_pending.push_back({ e.code, true, e.value });
+        }
+    }
+}
+
+void device_evdev::apply_event_mask(const std::shared_ptr<const cfg::mapping_table>& table)
+{
+    m_mask_table = table;
+    /* Masks are per descriptor, a shared one has to pass what every hook binds */
+    if (m_fd < 0 || !m_mask_supported || is_shared())
+        return;
+
+    unsigned long keys[EVDEV_LONGS(KEY_CNT)] = {};
+    unsigned long abs[EVDEV_LONGS(ABS_CNT)] = {};
+    unsigned long msc[EVDEV_LONGS(MSC_CNT)] = {};
+    unsigned long rel[EVDEV_LONGS(REL_CNT)] = {};
+    const auto set_bit = [](unsigned long* bits, size_t n) { bits[n / BITS_PER_LONG] |= 1ul << (n % BITS_PER_LONG); };
+
+    if (!m_event_filter || !table) {
+        /* An all set mask is the kernel's default of passing everything */
+        memset(keys, 0xff, sizeof(keys));
+        memset(abs, 0xff, sizeof(abs));
+        memset(msc, 0xff, sizeof(msc));
+        memset(rel, 0xff, sizeof(rel));
+    } else {
+        for (const auto& m : table->buttons) {
+            if (m.first < KEY_CNT)
+                set_bit(keys, m.first);
+            /* Dpad buttons might come from the hat, see stage() */
+            if (m.first == BTN_DPAD_LEFT || m.first == BTN_DPAD_RIGHT)
+                set_bit(abs, ABS_HAT0X);
+            else if (m.first == BTN_DPAD_UP || m.first == BTN_DPAD_DOWN)
+                set_bit(abs, ABS_HAT0Y);
+        }
+        for (const auto& m : table->axis) {
+            if (m.first < ABS_CNT)
+                set_bit(abs, m.first);
+        }
+    }
+
+    struct {
+        uint32_t type;
+        unsigned long* bits;
+        size_t size;
+    } masks[] = { { EV_KEY, keys, sizeof(keys) }, { EV_ABS, abs, sizeof(abs) }, { EV_MSC, msc, sizeof(msc) },
+        { EV_REL, rel, sizeof(rel) } };
+
+    for (const auto& m : masks) {
+        struct input_mask mask = { m.type, uint32_t(m.size), uint64_t(uintptr_t(m.bits)) };
+        if (ioctl(m_fd, EVIOCSMASK, &mask) < 0) {
+            /* Older than Linux 4.4, everything stays unfiltered */
+            gdebug("Couldn't set event mask for '%s': %s", m_device_path.c_str(), strerror(errno));
+            m_mask_supported = false;
+            return;
+        }
+    }
+}
+
+int device_evdev::commit()
+{
+    int result = update_result::NONE;
+    const auto binding = std::atomic_load(&m_native_binding);
+    const auto table = binding ? binding->get_table() : nullptr;
+
+    /* Catches copy on write edits of the mappings, which replace the table */
+    if (table != m_mask_table)
+        m_mask_dirty = true;
+
+    for (const auto& p : m_pending) {
+        uint16_t vc = 0;
+        float vv = 0.0f;
+
+        if (p.is_axis) {
+            if (table) {
+                vc = table->map_axis(p.code);
+                vv = normalize(p.code, p.value);
+                float deadzone = m_axis_deadzones[vc] / float(0xffff);
+
+                if (fabs(vv - m_axis[vc]) > deadzone) {
+                    m_axis[vc] = vv;
+                    result |= update_result::AXIS;
+                }
+            }
+            axis_event(p.code, vc, p.value, vv);
+        } else {
+            if (table) {
+                vc = table->map_button(p.code);
+                vv = p.value != 0;
+                if (m_buttons[vc] != (p.value != 0)) {
+                    m_buttons[vc] = p.value != 0;
+                    result |= update_result::BUTTON;
+                }
+            }
+            button_event(p.code, vc, p.value, vv);
+        }
+    }
+    m_pending.clear();
+    return result;
+}
+
+int device_evdev::resync()
+{
+    /* Events since the drop are gone, so read the whole state instead */
+    m_pending.clear();
+
+    unsigned long keys[EVDEV_LONGS(KEY_CNT)] = {};
+    if (ioctl(m_fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+        for (const auto code : m_key_codes)
+            m_pending.push_back({ code, false, test_bit(keys, code) });
+    }
+
+    for (const auto code : m_abs_codes) {
+        if (ioctl(m_fd, EVIOCGABS(code), &m_absinfo[code]) < 0)
+            continue;
+        struct ::input_event e = {};
+        e.type = EV_ABS;
+        e.code = code;
+        e.value = m_absinfo[code].value;
+        stage(e);
+    }
+    return commit();
+}
+
+int device_evdev::update()
+{
+    /* Apply at most one report that changed something per call, like device_linux
+     * does with single events, so handlers see every press and release. The rest
+     * of the batch stays buffered for the next call */
+    if (m_fd < 0)
+        return update_result::NONE;
+
+    if (m_mask_dirty.exchange(false)) {
+        const auto binding = std::atomic_load(&m_native_binding);
+        const auto table = binding ? binding->get_table() : nullptr;
+        apply_event_mask(table);
+    }
+
+    if (m_needs_sync.exchange(false)) {
+        const int result = resync();
+        if (result != update_result::NONE)
+            return result;
+    }
+
+    for (;;) {
+        while (m_read_pos < m_read_count) {
+            const auto& e = m_read_buffer[m_read_pos++];
+
+            if (e.type != EV_SYN) {
+                if (!m_dropped)
+                    stage(e);
+                continue;
+            }
+
+            if (e.code == SYN_DROPPED) {
+                if (!m_dropped)
+                    m_overflow_count++;
+                m_dropped = true;
+                m_pending.clear();
+            } else if (e.code == SYN_REPORT) {
+                const int result = m_dropped ? resync() : commit();
+                m_dropped = false;
+                m_report_time = uint64_t(e.input_event_sec) * 1000000 + e.input_event_usec;
+                if (result != update_result::NONE)
+                    return result;
+            }
+        }
+
+        const auto len = read_input(m_read_buffer.data(), m_read_buffer.size() * sizeof(struct ::input_event));
+        if (len < ssize_t(sizeof(struct ::input_event))) {
+            /* Unplugged, the descriptor is closed right away and the device
+             * is dropped once discovery notices the node is gone */
+            if (len < 0 && errno == ENODEV)
+                mark_stale();
+            return update_result::NONE;
+        }
+        m_read_pos = 0;
+        m_read_count = size_t(len) / sizeof(struct ::input_event);
+    }
+}
+
+void device_evdev::feed(const void* data, size_t len)
+{
+    /* Events that weren't processed yet stay in front of the new ones */
+    const auto count = len / sizeof(struct ::input_event);
+    if (m_read_pos > 0) {
+        std::copy(m_read_buffer.begin() + m_read_pos, m_read_buffer.begin() + m_read_count, m_read_buffer.begin());
+        m_read_count -= m_read_pos;
+        m_read_pos = 0;
+    }
+    if (m_read_count + count > m_read_buffer.size())
+        m_read_buffer.resize(m_read_count + count);
+    memcpy(&m_read_buffer[m_read_count], data, count * sizeof(struct ::input_event));
+    m_read_count += count;
+}
+
+void device_evdev::discard_input()
+{
+    /* A report that was partly staged is dropped with the rest */
+    m_read_pos = m_read_count = 0;
+    m_pending.clear();
+    m_dropped = false;
+    drop_queued();
+}
+
+void device_evdev::set_binding(std::shared_ptr<cfg::binding> b)
+{
+    std::atomic_store(&m_native_binding, std::dynamic_pointer_cast<cfg::binding_linux>(b));
+    device::set_binding(b);
+    /* State is stored by virtual code, so it has to be mapped again */
+    m_needs_sync = true;
+    m_mask_dirty = true;
+}
+
+void device_evdev::set_event_filter(bool enabled)
+{
+    m_event_filter = enabled;
+    m_mask_dirty = true;
+}
+}
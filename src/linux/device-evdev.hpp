@@ -0,0 +1,106 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include "device-node.hpp"
+#include <gamepad/binding-linux.hpp>
+#include <linux/input.h>
+#include <string>
+#include <vector>
+
+namespace gamepad {
+
+/* Gamepad read through the evdev interface (/dev/input/event*). Events are
+ * read in batches and only applied once the SYN_REPORT that ends their
+ * hardware report arrives, so a report is never seen half applied. */
+class device_evdev : public device_node {
+    /* A button or axis change waiting for the end of its report */
+    struct pending_event {
+        uint16_t code;
+        bool is_axis;
+        int32_t value;
+    };
+
+    /* Codes the device reports, read from its capability bits on init */
+    std::vector<uint16_t> m_key_codes;
+    std::vector<uint16_t> m_abs_codes;
+    std::array<struct input_absinfo, ABS_CNT> m_absinfo;
+    bool m_caps_seeded = false; /* Skip reading the capabilities on the next open */
+
+    std::vector<struct ::input_event> m_read_buffer;
+    size_t m_read_pos = 0, m_read_count = 0;
+    std::vector<pending_event> m_pending;
+    bool m_dropped = false; /* Kernel buffer overran, skip until the next SYN_REPORT and resync */
+    std::atomic<bool> m_needs_sync { false }; /* Read the full state on the next update */
+    uint64_t m_report_time = 0;
+
+    /* Kernel side event mask, only codes the binding maps are queued for us.
+     * It's recomputed on the hook thread whenever the binding, its table or
+     * the filter setting changes */
+    std::atomic<bool> m_event_filter { true };
+    std::atomic<bool> m_mask_dirty { true };
+    bool m_mask_supported = true;
+    std::shared_ptr<const cfg::mapping_table> m_mask_table;
+
+    /* Swapped atomically, so update() always sees a complete binding */
+    std::shared_ptr<cfg::binding_linux> m_native_binding;
+
+    bool read_capabilities();
+    void stage(const struct ::input_event& e);
+    int commit();
+    int resync();
+    float normalize(uint16_t code, int32_t value) const;
+    void apply_event_mask(const std::shared_ptr<const cfg::mapping_table>& table);
+
+protected:
+    bool on_open() override;
+    void on_close() override;
+
+public:
+    /* Without open the device is only opened on the first init() */
+    device_evdev(const std::string& path, bool open = true);
+    virtual ~device_evdev();
+
+    /* Checks the capability bits of an event node for gamepad buttons */
+    static bool is_gamepad(int fd);
+
+    const std::vector<uint16_t>& get_key_codes() const { return m_key_codes; }
+    const std::vector<uint16_t>& get_abs_codes() const { return m_abs_codes; }
+    const struct input_absinfo& get_absinfo(uint16_t code) const { return m_absinfo[code]; }
+
+    /* Capabilities from a previous run, the next open uses them instead
+     * of reading them from the device. Current axis values are still
+     * read when the state is synced */
+    void seed_capabilities(const std::vector<uint16_t>& key_codes,
+        const std::vector<std::pair<uint16_t, struct input_absinfo>>& abs);
+
+    /* Monotonic time of the last applied report in microseconds */
+    uint64_t get_report_time() const { return m_report_time; }
+
+    int update() override;
+    bool has_pending() const override { return m_read_pos < m_read_count; }
+    void feed(const void* data, size_t len) override;
+    void discard_input() override;
+    void reload_state() override { m_needs_sync = true; }
+    void set_binding(std::shared_ptr<cfg::binding> b) override;
+    void set_event_filter(bool enabled) override;
+};
+}
@@ -18,17 +18,33 @@
 
 #include "device-linux.hpp"
 #include <algorithm>
-#include <fcntl.h>
+#include <cstdlib>
+#include <cstring>
 #include <gamepad/binding-linux.hpp>
 #include <gamepad/log.hpp>
 #include <unistd.h>
 
 namespace gamepad {
-device_linux::device_linux(const std::string path)
-    : m_device_path(path)
+
+/* Events read per read() call, joydev's queue holds 64 */
+static const size_t JS_BATCH_SIZE = 64;
+
+/* Kernel code -> virtual code, the evdev default binding is keyed by kernel codes */
+static std::shared_ptr<const cfg::mapping_table> kernel_code_table()
+{
+#ifdef LGP_ENABLE_JSON
+    static const auto table = cfg::binding_linux(cfg::evdev_default_binding).get_table();
+    return table;
+#else
+    return nullptr;
+#endif
+}
+
+device_linux::device_linux(const std::string& path, bool open)
+    : device_node(path)
 {
-    m_fd = -1;
-    device_linux::init();
+    if (open)
+        device_linux::init();
 }
 
 device_linux::~device_linux()
@@ -36,106 +52,266 @@ device_linux::~device_linux()
     device_linux::deinit();
 }
 
-void device_linux::init()
+bool device_linux::on_open()
 {
-    /* If this descriptor is still valid do nothing */
-    if (fcntl(m_fd, F_GETFD) != -1 || errno != EBADF) {
-        gdebug("Descriptor is still valid");
-        if (errno == EBADF)
-            gerr("errno is EBADF");
-        return;
+    /* A new descriptor starts with joydev sending the current state. The
+     * buffers are only allocated on the first open and reused afterwards */
+    m_events.resize(JS_BATCH_SIZE);
+    m_event_pos = m_event_count = 0;
+    m_maybe_more = false;
+    m_startup = true;
+    m_loading_state = false;
+
+    char namebuffer[256];
+    if (ioctl(m_fd, JSIOCGNAME(256), &namebuffer) != -1) {
+        m_name = namebuffer;
     }
+    query_capabilities();
 
-    device_linux::deinit();
-    m_fd = open(m_device_path.c_str(), O_RDONLY | O_NONBLOCK);
-    m_valid = m_fd != -1;
+    if (m_name.empty()) {
+        int begin_idx = m_device_path.rfind('/');
+        m_name = m_device_path.substr(begin_idx + 1);
+        m_device_id = m_name;
+    } else {
+        int begin_idx = m_device_path.rfind('/');
+        std::string fd_name = m_device_path.substr(begin_idx + 1);
+        m_device_id = "(" + fd_name + ") " + m_name;
+    }
+    gdebug("Initialized gamepad from '%s' with id '%s'", m_device_path.c_str(), m_device_id.c_str());
+    return true;
+}
+
+void device_linux::on_close()
+{
+    m_event_pos = m_event_count = 0;
+    m_maybe_more = false;
+}
+
+void device_linux::query_capabilities()
+{
+    if (!m_caps.name.empty() && m_caps.name == m_name) {
+        gdebug("Reusing capabilities of '%s'", m_name.c_str());
+    } else {
+        m_caps = js_capabilities();
+        m_caps.name = m_name;
+
+        uint8_t count = 0;
+        if (ioctl(m_fd, JSIOCGAXES, &count) != -1)
+            m_caps.axes = count;
+        if (ioctl(m_fd, JSIOCGBUTTONS, &count) != -1)
+            m_caps.buttons = count;
+
+        uint8_t axis_map[ABS_CNT];
+        uint16_t button_map[KEY_MAX - BTN_MISC + 1];
+        if (ioctl(m_fd, JSIOCGAXMAP, axis_map) != -1)
+            m_caps.axis_codes.assign(axis_map, axis_map + m_caps.axes);
+        if (ioctl(m_fd, JSIOCGBTNMAP, button_map) != -1)
+            m_caps.button_codes.assign(button_map, button_map + m_caps.buttons);
 
-    if (m_valid) {
-        char namebuffer[256];
-        if (ioctl(m_fd, JSIOCGNAME(256), &namebuffer) != -1) {
-            m_name = namebuffer;
+        gdebug("'%s' has %i axes and %i buttons", m_name.c_str(), m_caps.axes, m_caps.buttons);
+    }
+
+    m_raw_axis.assign(m_caps.axes, 0);
+    m_raw_buttons.assign(m_caps.buttons, 0);
+}
+
+std::shared_ptr<cfg::binding> device_linux::make_kernel_binding() const
+{
+    const auto codes = kernel_code_table();
+    if (!codes)
+        return nullptr;
+
+    auto b = std::make_shared<cfg::binding_linux>();
+    b->set_name("Kernel mapped binding");
+    auto& buttons = b->edit().buttons;
+    auto& axis = b->edit().axis;
+    bool has_hat = false;
+
+    for (size_t i = 0; i < m_caps.button_codes.size(); i++) {
+        const auto vc = codes->map_button(m_caps.button_codes[i]);
+        if (vc)
+            buttons[i] = vc;
+    }
+
+    for (size_t i = 0; i < m_caps.axis_codes.size(); i++) {
+        const auto code = m_caps.axis_codes[i];
+        if (code == ABS_HAT0X || code == ABS_HAT0Y) {
+            has_hat = true;
+            continue;
         }
+        const auto vc = codes->map_axis(code);
+        if (vc)
+            axis[i] = vc;
+    }
+
+    /* Hat axes are turned into buttons with the dpad codes, see update() */
+    if (has_hat) {
+        for (uint16_t code = BTN_DPAD_UP; code <= BTN_DPAD_RIGHT; code++)
+            buttons[code] = codes->map_button(code);
+    }
+
+    if (buttons.empty() && axis.empty())
+        return nullptr;
 
-        if (m_name.empty()) {
-            int begin_idx = m_device_path.rfind('/');
-            m_name = m_device_path.substr(begin_idx + 1);
-            m_device_id = m_name;
+    /* Identical gamepads end up sharing one table */
+    b->commit();
+    return b;
+}
+
+int device_linux::button_update(const cfg::mapping_table* table, uint16_t native_id, int32_t value, bool silent)
+{
+    uint16_t vc = 0;
+    float vv = 0.0f;
+    int result = update_result::NONE;
+
+    if (table) {
+        vc = table->map_button(native_id);
+        vv = value;
+        auto old_value = m_buttons[vc];
+        if (old_value != vv) {
+            m_buttons[vc] = value;
+            result = update_result::BUTTON;
+        }
+    }
+    if (!silent)
+        button_event(native_id, vc, value, vv);
+    return result;
+}
+
+int device_linux::apply_event(const cfg::mapping_table* table, const struct js_event& e, bool silent)
+{
+    uint16_t vc = 0;
+    float vv = 0.0f;
+    int result = update_result::NONE;
+    const auto type = e.type & ~JS_EVENT_INIT;
+    const auto number = e.number;
+
+    if (type == JS_EVENT_AXIS) {
+        /* Only happens if the driver didn't tell us the axis count */
+        if (number >= m_raw_axis.size())
+            m_raw_axis.resize(number + 1, 0);
+
+        const auto code = number < m_caps.axis_codes.size() ? m_caps.axis_codes[number] : ABS_CNT;
+        const bool hat_as_dpad = (code == ABS_HAT0X || code == ABS_HAT0Y) && (!table || !table->map_axis(number));
+
+        if (hat_as_dpad) {
+            const bool x = code == ABS_HAT0X;
+            result |= button_update(table, x ? BTN_DPAD_LEFT : BTN_DPAD_UP, e.value < 0, silent);
+            result |= button_update(table, x ? BTN_DPAD_RIGHT : BTN_DPAD_DOWN, e.value > 0, silent);
         } else {
-            int begin_idx = m_device_path.rfind('/');
-            std::string fd_name = m_device_path.substr(begin_idx + 1);
-            m_device_id = "(" + fd_name + ") " + m_name;
+            if (table) {
+                vc = table->map_axis(number);
+                /* A state load always applies, there's no previous value to compare to */
+                if (silent || abs(e.value - m_raw_axis[number]) > m_axis_deadzones[vc]) {
+                    m_raw_axis[number] = e.value;
+                    vv = clamp(float(e.value) / 0xffff + 0.5f, -1.f, 1.f);
+                    if (m_axis[vc] != vv)
+                        result = update_result::AXIS;
+                    m_axis[vc] = vv;
+                }
+            }
+            if (!silent)
+                axis_event(number, vc, e.value, vv);
         }
-        gdebug("Initialized gamepad from '%s' with id '%s'", m_device_path.c_str(), m_device_id.c_str());
-    } else {
-        gerr("Invalid file descriptor from '%s'", m_device_path.c_str());
+    } else if (type == JS_EVENT_BUTTON) {
+        if (number >= m_raw_buttons.size())
+            m_raw_buttons.resize(number + 1, 0);
+        m_raw_buttons[number] = e.value != 0;
+        result = button_update(table, number, e.value, silent);
     }
+
+    return result;
 }
 
-void device_linux::deinit()
+bool device_linux::fill_buffer()
 {
-    if (m_fd < 0)
-        return;
+    if (m_event_pos < m_event_count)
+        return true;
 
-    if (close(m_fd) == -1)
-        gerr("Couldn't close file descriptor for device '%s'", device_linux::get_id().c_str());
+    m_event_pos = m_event_count = 0;
+    m_maybe_more = false;
+    const auto len = read_input(m_events.data(), m_events.size() * sizeof(struct js_event));
+    if (len < ssize_t(sizeof(struct js_event)))
+        return false;
 
-    m_fd = -1;
+    m_event_count = size_t(len) / sizeof(struct js_event);
+    m_maybe_more = m_event_count == m_events.size();
+    return true;
 }
 
-const std::string& device_linux::get_id() const
+void device_linux::feed(const void* data, size_t len)
 {
-    return m_device_id;
+    /* Events that weren't processed yet stay in front of the new ones */
+    const auto count = len / sizeof(struct js_event);
+    if (m_event_pos > 0) {
+        std::copy(m_events.begin() + m_event_pos, m_events.begin() + m_event_count, m_events.begin());
+        m_event_count -= m_event_pos;
+        m_event_pos = 0;
+    }
+    if (m_event_count + count > m_events.size())
+        m_events.resize(m_event_count + count);
+    memcpy(&m_events[m_event_count], data, count * sizeof(struct js_event));
+    m_event_count += count;
+}
+
+void device_linux::discard_input()
+{
+    m_event_pos = m_event_count = 0;
+    m_maybe_more = false;
+    drop_queued();
 }
 
 int device_linux::update()
 {
-    /* Process only the next event, this can result in a delay if there are many
-     * events queued up, but it'll prevent buttons from getting stuck, which happens
-     * if the button released event is skipped */
-    if (read(m_fd, &m_event, sizeof(m_event)) != sizeof(m_event))
+    /* Events are read in batches, but still processed one per call, so handlers
+     * see every press and release. has_pending() tells the hook thread to call
+     * again right away while there's buffered input */
+    if (m_fd < 0)
         return update_result::NONE;
 
-    uint16_t vc = 0;
-    float vv = 0.0f;
     int result = update_result::NONE;
+    const auto binding = std::atomic_load(&m_native_binding);
+    const auto table = binding ? binding->get_table() : nullptr;
 
-    if (m_event.type == JS_EVENT_AXIS) {
-        if (m_native_binding) {
-            vc = m_native_binding->m_axis_mappings[m_event.number];
-            auto val = float(m_event.value), last_val = m_axis[vc];
-            float deadzone = m_axis_deadzones[vc] / float(0xffff);
+    while (fill_buffer()) {
+        const auto& e = m_events[m_event_pos];
 
-            if (fabs(val - last_val) > deadzone) {
-                vv = clamp(val / 0xffff + 0.5f, -1.f, 1.f);
-                m_axis[vc] = vv;
-                result = update_result::AXIS;
+        /* joydev sends the full state as INIT events after open, and again whenever
+         * our queue overflowed and events were lost. Either way it's loaded in bulk
+         * without per input events, after an overflow the update reports what
+         * changed once the load is complete */
+        if (e.type & JS_EVENT_INIT) {
+            if (!m_startup && !m_loading_state) {
+                m_overflow_count++;
+                gwarn("Event queue of '%s' overflowed, reloading state (%u overflows)", m_device_id.c_str(),
+                    m_overflow_count);
             }
+            m_loading_state = true;
+            result |= apply_event(table.get(), e, true);
+            m_event_pos++;
+            continue;
         }
-        axis_event(m_event.number, vc, m_event.value, vv);
-    } else if (m_event.type == JS_EVENT_BUTTON) {
-        if (m_native_binding) {
-            vc = m_native_binding->m_buttons_mappings[m_event.number];
-            vv = m_event.value;
-            auto old_value = m_buttons[vc];
-            if (old_value != vv) {
-                m_buttons[vc] = m_event.value;
-                result = update_result::BUTTON;
-            }
+
+        if (m_loading_state) {
+            m_loading_state = false;
+            if (m_startup)
+                result = update_result::NONE;
+            else if (result != update_result::NONE)
+                return result; /* Report the reload, e is processed on the next call */
         }
-        button_event(m_event.number, vc, m_event.value, vv);
+
+        m_startup = false;
+        m_event = e;
+        m_event_pos++;
+        return result | apply_event(table.get(), m_event, false);
     }
 
-    return result;
+    return m_startup ? int(update_result::NONE) : result;
 }
 
 void device_linux::set_binding(std::shared_ptr<cfg::binding> b)
 {
+    std::atomic_store(&m_native_binding, std::dynamic_pointer_cast<cfg::binding_linux>(b));
     device::set_binding(b);
-    m_native_binding = dynamic_cast<cfg::binding_linux*>(b.get());
-}
-
-void device_linux::set_id(const std::string& id)
-{
-    m_device_id = id;
 }
 }
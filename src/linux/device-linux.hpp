@@ -18,31 +18,73 @@
 
 #pragma once
 
+#include "device-node.hpp"
 #include <gamepad/binding-linux.hpp>
-#include <gamepad/device.hpp>
 #include <linux/joystick.h>
 #include <string>
+#include <vector>
 
 namespace gamepad {
 
-class device_linux : public device {
-    std::string m_device_path;
-    std::string m_device_id;
-    int m_fd;
-    struct js_event m_event;
-    cfg::binding_linux* m_native_binding = nullptr;
+/* What joydev tells us about a gamepad, queried once on open */
+struct js_capabilities {
+    std::string name;
+    uint8_t axes = 0;
+    uint8_t buttons = 0;
+    std::vector<uint8_t> axis_codes; /* js axis number -> ABS_* code */
+    std::vector<uint16_t> button_codes; /* js button number -> BTN_* code */
+};
+
+class device_linux : public device_node {
+    struct js_event m_event; /* Last processed event */
+
+    std::vector<struct js_event> m_events;
+    size_t m_event_pos = 0, m_event_count = 0;
+    bool m_maybe_more = false; /* The last read filled the buffer, more might be queued */
+    bool m_startup = true; /* Nothing but the state sent after open was read yet */
+    bool m_loading_state = false; /* Inside a run of INIT events */
+    /* Swapped atomically, so update() always sees a complete binding */
+    std::shared_ptr<cfg::binding_linux> m_native_binding;
+
+    /* Kept when the device is closed, so a reconnect of the same
+     * gamepad only has to check the name */
+    js_capabilities m_caps;
+
+    /* Last native value per js axis and button number, sized from m_caps */
+    std::vector<int16_t> m_raw_axis;
+    std::vector<uint8_t> m_raw_buttons;
+
+    void query_capabilities();
+    int button_update(const cfg::mapping_table* table, uint16_t native_id, int32_t value, bool silent);
+    int apply_event(const cfg::mapping_table* table, const struct js_event& e, bool silent);
+    bool fill_buffer();
+
+protected:
+    bool on_open() override;
+    void on_close() override;
+    bool is_js() const override { return true; }
 
 public:
-    device_linux(std::string path);
+    /* Without open the device is only opened on the first init() */
+    device_linux(const std::string& path, bool open = true);
     virtual ~device_linux();
 
-    const std::string& get_id() const override;
-    void set_id(const std::string& id) override;
-    const std::string& get_path() const { return m_device_path; }
-    const std::string& get_cache_id() override { return get_path(); }
-    void init() override;
-    void deinit() override;
     int update() override;
+    bool has_pending() const override { return m_event_pos < m_event_count || m_maybe_more; }
+    void feed(const void* data, size_t len) override;
+    void discard_input() override;
+    /* The reactor replays the state as INIT events, they're loaded like the ones after open */
+    void reload_state() override { m_startup = true; }
     void set_binding(std::shared_ptr<cfg::binding> b) override;
+
+    const js_capabilities& get_capabilities() const { return m_caps; }
+
+    /* Capabilities from a previous run, they're used instead of querying the
+     * axis and button maps if the name still matches once the device is opened */
+    void seed_capabilities(const js_capabilities& caps) { m_caps = caps; }
+
+    /* Builds a binding from the kernel codes joydev reports for each axis and
+     * button, nullptr if the driver didn't report any */
+    std::shared_ptr<cfg::binding> make_kernel_binding() const;
 };
 }
@@ -0,0 +1,171 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "device-node.hpp"
+#include "io-engine.hpp"
+#include "reactor.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <gamepad/log.hpp>
+#include <unistd.h>
+
+namespace gamepad {
+
+uint64_t device_node::now_us()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void device_node::close_fd()
+{
+    if (m_fd < 0)
+        return;
+
+    if (m_engine)
+        m_engine->detach(this);
+    on_close();
+    if (m_reactor)
+        m_reactor->close_node(m_fd);
+    else if (close(m_fd) == -1)
+        gerr("Couldn't close file descriptor for device '%s'", m_device_id.c_str());
+    m_fd = -1;
+}
+
+ssize_t device_node::read_input(void* buf, size_t size)
+{
+    if (m_read_error) {
+        errno = m_read_error;
+        m_read_error = 0;
+        return -1;
+    }
+
+    /* Shared descriptors are only read by the reactor */
+    if (m_reactor || m_io_mode == io_mode::FED || (m_io_mode == io_mode::NOTIFIED && !m_readable)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    const auto len = read(m_fd, buf, size);
+    if (len < 0 && errno == EAGAIN)
+        m_readable = false;
+    return len;
+}
+
+void device_node::drop_queued()
+{
+    if (m_fd < 0 || m_reactor || m_io_mode == io_mode::FED)
+        return;
+
+    char buf[1024];
+    while (read(m_fd, buf, sizeof(buf)) > 0) { }
+    m_readable = false;
+}
+
+void device_node::set_io(io_engine* engine, int slot, io_mode::type mode)
+{
+    m_engine = engine;
+    m_io_slot = slot;
+    m_io_mode = mode;
+    m_readable = true;
+    m_read_error = 0;
+}
+
+void device_node::init()
+{
+    if (m_state == node_state::OPEN)
+        return;
+
+    m_state = node_state::PROBING;
+    if (m_reactor)
+        m_fd = m_reactor->open_node(m_device_path, is_js());
+    else
+        m_fd = open(m_device_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (m_fd < 0) {
+        gdebug("Couldn't open '%s': %s", m_device_path.c_str(), strerror(errno));
+        m_valid = false;
+        m_state = node_state::CLOSED;
+        return;
+    }
+
+    if (!on_open()) {
+        close_fd();
+        m_valid = false;
+        m_state = node_state::CLOSED;
+        return;
+    }
+
+    m_valid = true;
+    m_state = node_state::OPEN;
+}
+
+void device_node::deinit()
+{
+    close_fd();
+    m_state = node_state::CLOSED;
+}
+
+bool device_node::reopen(const std::string& path, bool open)
+{
+    const auto state = m_state.load();
+    if (state != node_state::STALE && state != node_state::CLOSED)
+        return false;
+
+    m_probe_start = now_us();
+    m_device_path = path;
+    if (!open) {
+        m_valid = true;
+        m_state = node_state::CLOSED;
+        return true;
+    }
+
+    init();
+    if (m_state != node_state::OPEN) {
+        m_state = node_state::STALE;
+        return false;
+    }
+    return true;
+}
+
+void device_node::identify(const std::string& name)
+{
+    const auto node = m_device_path.substr(m_device_path.rfind('/') + 1);
+    m_name = name.empty() ? node : name;
+    m_device_id = name.empty() ? node : "(" + node + ") " + name;
+}
+
+void device_node::mark_stale()
+{
+    if (m_state != node_state::OPEN)
+        return;
+
+    close_fd();
+    m_valid = false;
+    m_state = node_state::STALE;
+}
+
+void device_node::finish_reconnect()
+{
+    m_reconnect_latency = now_us() - m_probe_start;
+    m_reconnect_count++;
+    gdebug("'%s' reconnected in %llu us (%u reconnects)", m_device_id.c_str(),
+        static_cast<unsigned long long>(m_reconnect_latency), m_reconnect_count);
+}
+}
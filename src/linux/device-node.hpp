@@ -0,0 +1,156 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <gamepad/device.hpp>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+namespace gamepad {
+class io_engine;
+class reactor;
+
+namespace node_state {
+    enum type : uint8_t {
+        CLOSED, /* Never opened, couldn't be opened or closed for good */
+        PROBING, /* Being opened and queried, the hook thread doesn't read it yet */
+        OPEN, /* Descriptor is open and read by the hook thread */
+        STALE /* The node went away, the descriptor is closed, but the instance
+               * keeps its binding and buffers for when the gamepad comes back */
+    };
+}
+
+/* How input gets from the descriptor into the device */
+namespace io_mode {
+    enum type : uint8_t {
+        SELF, /* update() reads the descriptor on every call */
+        NOTIFIED, /* update() only reads once the io engine saw the descriptor become readable */
+        FED /* The io engine reads the descriptor and passes the data to feed() */
+    };
+}
+
+/* Base of the gamepads that are read from a node in /dev/input. The descriptor
+ * is only opened and closed on state transitions, so calling init() on an open
+ * device or deinit() on a closed one doesn't touch it */
+class device_node : public device, public std::enable_shared_from_this<device_node> {
+protected:
+    std::string m_device_path;
+    std::string m_device_id;
+    std::string m_cache_id;
+    int m_fd = -1;
+    std::atomic<uint8_t> m_state { node_state::CLOSED };
+    uint64_t m_probe_start = 0; /* When the last reopen began, in microseconds */
+    uint64_t m_last_used = 0;
+    bool m_kernel_binding_pending = false;
+
+    /* Set by the io engine the descriptor is attached to */
+    io_engine* m_engine = nullptr;
+    int m_io_slot = -1;
+    io_mode::type m_io_mode = io_mode::SELF;
+    bool m_readable = true;
+    int m_read_error = 0; /* Error of a read the engine did, returned by the next read_input() */
+
+    /* Set for devices of shared hooks, the descriptor belongs to the reactor */
+    std::shared_ptr<reactor> m_reactor;
+
+    /* Called with the descriptor open, queries the node and resets the
+     * read state. Returns false if the node isn't a usable gamepad */
+    virtual bool on_open() = 0;
+    /* Called before the descriptor is closed */
+    virtual void on_close() { }
+    /* Whether the node is a joydev one, tells shared nodes apart by kind */
+    virtual bool is_js() const { return false; }
+
+    void close_fd();
+
+    /* read() that follows the io mode, fails with EAGAIN if there's
+     * nothing to read without asking the kernel */
+    ssize_t read_input(void* buf, size_t size);
+
+    /* Reads and drops what the kernel queued, unless an engine reads the descriptor */
+    void drop_queued();
+
+public:
+    device_node(const std::string& path)
+        : m_device_path(path)
+    {
+    }
+
+    const std::string& get_id() const override { return m_device_id; }
+    void set_id(const std::string& id) override { m_device_id = id; }
+    const std::string& get_path() const { return m_device_path; }
+
+    /* Identity from sysfs if the hook set one, otherwise the path */
+    const std::string& get_cache_id() override { return m_cache_id.empty() ? m_device_path : m_cache_id; }
+    void set_cache_id(const std::string& id) { m_cache_id = id; }
+
+    node_state::type get_state() const { return node_state::type(m_state.load()); }
+
+    /* CLOSED -> PROBING -> OPEN, or back to CLOSED if the node can't be used */
+    void init() override;
+    /* Any state -> CLOSED */
+    void deinit() override;
+
+    /* STALE or CLOSED -> PROBING -> OPEN under a possibly different node.
+     * Stays STALE if the node can't be used. Without open the device only
+     * moves to the new node and stays CLOSED until init() is called */
+    bool reopen(const std::string& path, bool open = true);
+
+    /* Names a device that wasn't opened yet from its sysfs name, which is the
+     * same name the driver reports once it's opened */
+    void identify(const std::string& name);
+
+    /* Lazily opened js devices get their kernel binding once they're opened */
+    bool is_kernel_binding_pending() const { return m_kernel_binding_pending; }
+    void set_kernel_binding_pending(bool pending) { m_kernel_binding_pending = pending; }
+
+    /* Last time the hook saw the device in use, in microseconds */
+    uint64_t get_last_used() const { return m_last_used; }
+    void mark_used() { m_last_used = now_us(); }
+
+    static uint64_t now_us();
+
+    /* Used by io engines to attach and detach the descriptor */
+    int get_fd() const { return m_fd; }
+    io_engine* get_engine() const { return m_engine; }
+    int get_io_slot() const { return m_io_slot; }
+    void set_io(io_engine* engine, int slot, io_mode::type mode);
+    void set_readable() { m_readable = true; }
+    void set_read_error(int error) { m_read_error = error; }
+
+    /* Opens the node through r from now on, only called while the device is closed */
+    void set_reactor(std::shared_ptr<reactor> r) { m_reactor = std::move(r); }
+    bool is_shared() const { return m_reactor != nullptr; }
+
+    /* Appends data an engine read from the descriptor to the unprocessed input */
+    virtual void feed(const void* data, size_t len) = 0;
+
+    /* Loads the full state on the next update without reporting it, for shared
+     * nodes whose input other hooks read while the device wasn't subscribed */
+    virtual void reload_state() { }
+
+    /* OPEN -> STALE once the node is gone */
+    void mark_stale();
+
+    /* Called once a reopened device is read again, records how long it took */
+    void finish_reconnect();
+};
+}
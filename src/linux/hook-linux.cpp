@@ -16,13 +16,28 @@
  ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+#include "device-evdev.hpp"
 #include "device-linux.hpp"
+#include "device-node.hpp"
+#include "io-engine.hpp"
+#include "reactor.hpp"
+#include "mpsc-queue.hpp"
+#include "sysfs.hpp"
+#include "warm-state.hpp"
 #include <algorithm>
+#include <cerrno>
 #include <chrono>
-#include <dirent.h>
+#include <cstring>
+#include <fcntl.h>
 #include <gamepad/hook-linux.hpp>
 #include <gamepad/log.hpp>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <tuple>
+#include <unistd.h>
 #include <vector>
 
 using namespace std;
@@ -30,160 +45,1167 @@ using namespace json11;
 
 namespace gamepad {
 
+/* A device the discovery side opened or lost, for the hook thread to adopt or remove */
+struct hook_linux::discovery_event {
+    std::shared_ptr<device> dev;
+    std::shared_ptr<cfg::binding> kernel_binding;
+    bool reconnect = false;
+    bool warm = false; /* Restored by load_warm_state, connected for the first time */
+    bool removed = false;
+    uint32_t epoch = 0; /* m_discovery_epoch when it was queued */
+};
+
 hook_linux::hook_linux(uint16_t flags)
-    : m_flags(flags)
+    : m_discovered(new mpsc_queue<discovery_event>())
+    , m_flags(flags)
+{
+    m_control_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_control_fd < 0)
+        gerr("Couldn't create eventfd: %s", strerror(errno));
+
+    if (flags & hook_type::SHARED) {
+        m_reactor = reactor::get();
+        m_engine = m_reactor->make_engine(
+            [this](const std::weak_ptr<device_node>& node, const std::atomic<bool>& detached, const void* data,
+                ssize_t len) { dispatch_device(node, detached, data, len); });
+    }
+}
+
+hook_linux::~hook_linux()
+{
+    /* The watch and discovery threads call into this instance, so they have to be gone before we are */
+    hook_linux::unwatch_bindings();
+    hook_linux::stop();
+    if (m_control_fd >= 0)
+        close(m_control_fd);
+}
+
+bool hook_linux::watch_bindings(const std::string& path)
+{
+    unwatch_bindings();
+
+    /* Editors usually replace the file instead of writing to it, which
+     * would drop a watch on the file itself, so the directory is watched */
+    auto separator = path.rfind('/');
+    auto dir = separator == string::npos ? string(".") : path.substr(0, separator);
+    m_watch_file = separator == string::npos ? path : path.substr(separator + 1);
+    m_watch_path = path;
+
+    m_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_watch_fd < 0) {
+        gerr("Couldn't create inotify instance: %s", strerror(errno));
+        return false;
+    }
+
+    if (inotify_add_watch(m_watch_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        gerr("Couldn't watch '%s': %s", dir.c_str(), strerror(errno));
+        close(m_watch_fd);
+        m_watch_fd = -1;
+        return false;
+    }
+
+    m_watch_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_watch_wake_fd < 0) {
+        gerr("Couldn't create eventfd: %s", strerror(errno));
+        close(m_watch_fd);
+        m_watch_fd = -1;
+        return false;
+    }
+
+    m_watch_thread = thread(&hook_linux::watch_thread, this);
+    gdebug("Watching bindings in '%s'", path.c_str());
+    return true;
+}
+
+void hook_linux::unwatch_bindings()
 {
+    if (m_watch_thread.joinable()) {
+        uint64_t one = 1;
+        if (write(m_watch_wake_fd, &one, sizeof(one)) != sizeof(one))
+            gerr("Couldn't wake bindings watch thread");
+        m_watch_thread.join();
+    }
+
+    if (m_watch_fd >= 0)
+        close(m_watch_fd);
+    if (m_watch_wake_fd >= 0)
+        close(m_watch_wake_fd);
+    m_watch_fd = m_watch_wake_fd = -1;
+}
+
+void hook_linux::watch_thread()
+{
+    alignas(struct inotify_event) char buf[4096];
+    struct pollfd fds[2] = { { m_watch_fd, POLLIN, 0 }, { m_watch_wake_fd, POLLIN, 0 } };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            gerr("Polling bindings watch failed: %s", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents)
+            break;
+
+        bool changed = false;
+        ssize_t len;
+        while ((len = read(m_watch_fd, buf, sizeof(buf))) > 0) {
+            for (char* ptr = buf; ptr < buf + len;) {
+                auto* e = reinterpret_cast<struct inotify_event*>(ptr);
+                if (e->len && m_watch_file == e->name)
+                    changed = true;
+                ptr += sizeof(struct inotify_event) + e->len;
+            }
+        }
+
+        if (changed)
+            reload_bindings(m_watch_path);
+    }
+}
+
+/* Every device this hook creates reads from a node */
+static device_node* as_node(const std::shared_ptr<device>& dev)
+{
+    return static_cast<device_node*>(dev.get());
 }
 
 std::shared_ptr<device> hook_linux::get_device_by_path(const std::string& path)
 {
-    for (auto& dev : m_devices) {
-        if (dynamic_pointer_cast<device_linux>(dev)->get_path() == path)
-            return dev;
+    std::lock_guard<std::mutex> lock(m_index_mutex);
+    auto it = m_node_index.find(path);
+    return it == m_node_index.end() ? nullptr : it->second.dev.lock();
+}
+
+std::shared_ptr<device> hook_linux::probe_node(const std::string& path, bool& irrelevant)
+{
+    const bool evdev = m_flags & hook_type::EVDEV;
+    sysfs::identity identity;
+    const bool has_identity = sysfs::read_identity(path, identity);
+
+    /* Keyboards, mice and the like are skipped without opening them */
+    if (evdev && has_identity && !identity.is_gamepad) {
+        irrelevant = true;
+        return nullptr;
+    }
+
+    /* Known devices are found by their identity, even if they came back under another node */
+    const auto cache_id = has_identity ? identity.key() : path;
+    std::shared_ptr<device> cached_dev;
+    discovery_event e;
+    bool lazy;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        cached_dev = get_cached_device(cache_id);
+
+        /* Devices can only be named without opening them through sysfs */
+        lazy = m_lazy_open && has_identity;
+
+        /* The hook thread is still reading it through its old node until it
+         * handles the removal, so it's picked up on the next scan instead */
+        if (cached_dev && find(m_devices.begin(), m_devices.end(), cached_dev) != m_devices.end())
+            return nullptr;
+        e.warm = cached_dev && m_warm_devices.erase(cache_id) > 0;
     }
-    return nullptr;
+
+    if (cached_dev) {
+        /* Not in the device list, so nothing else touches it while it's reopened.
+         * It keeps its binding and buffers, only the descriptor is new */
+        gdebug("Using cached device instance for '%s'", path.c_str());
+        auto* node = as_node(cached_dev);
+        if (!node->reopen(path, !lazy)) {
+            if (e.warm) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_warm_devices[cache_id] = cached_dev;
+            }
+            return nullptr;
+        }
+        if (lazy)
+            node->identify(identity.name);
+        e.dev = cached_dev;
+        e.reconnect = !e.warm;
+    } else {
+        std::shared_ptr<device_node> node;
+        if (evdev)
+            node = make_shared<device_evdev>(path, false);
+        else
+            node = make_shared<device_linux>(path, false);
+        node->set_reactor(m_reactor);
+        if (!lazy)
+            node->init();
+        if (has_identity)
+            node->set_cache_id(cache_id);
+
+        /* Opened by the hook thread once something uses it, see update_lazy_devices() */
+        if (lazy) {
+            node->set_valid();
+            node->identify(identity.name);
+            node->set_kernel_binding_pending(!evdev);
+        }
+        e.dev = node;
+
+        if (!e.dev->is_valid()) {
+            /* A node we can read that still isn't usable won't become a gamepad,
+             * one we can't read might once udev has set its permissions */
+            irrelevant = access(path.c_str(), R_OK) == 0;
+            gdebug("'%s' is not a valid gamepad", path.c_str());
+            return nullptr;
+        }
+
+        gdebug("Found gamepad at '%s'", path.c_str());
+        if (!evdev && !lazy)
+            e.kernel_binding = dynamic_pointer_cast<device_linux>(e.dev)->make_kernel_binding();
+    }
+
+    auto dev = e.dev;
+    e.epoch = m_discovery_epoch;
+    m_discovered->push(move(e));
+    return dev;
 }
 
-void hook_linux::check_dev_by_id()
+const char* hook_linux::device_folder() const
 {
-    static const char* DEV_FOLDER = "/dev/input/by-id";
-    DIR* dir;
-    struct dirent* ent;
-    int device_counter = 0;
+    if (m_flags & (hook_type::EVDEV | hook_type::JS))
+        return "/dev/input";
+    return "/dev/input/by-id";
+}
 
-    if ((dir = opendir(DEV_FOLDER)) == NULL) {
-        gerr("Couldn't open %s", DEV_FOLDER);
-        return;
+bool hook_linux::is_candidate(const char* name) const
+{
+    if (m_flags & hook_type::EVDEV)
+        return strncmp(name, "event", 5) == 0;
+    if (m_flags & hook_type::JS)
+        return strncmp(name, "js", 2) == 0;
+
+    /* by-id names look like usb-Vendor_Controller-event-joystick, only the js links are used */
+    std::string lower(name);
+    transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return tolower(c); });
+    return (lower.find("gamepad") != string::npos || lower.find("joystick") != string::npos)
+        && lower.find("event") == string::npos;
+}
+
+bool hook_linux::scan(scan_result& result)
+{
+    const char* folder = device_folder();
+    folder_fingerprint fingerprint;
+    struct stat st;
+
+    /* Adding or removing a node changes the folder's mtime, the inode
+     * changes if the folder itself is recreated */
+    if (stat(folder, &st) == 0) {
+        fingerprint.dev = st.st_dev;
+        fingerprint.ino = st.st_ino;
+        fingerprint.mtime_sec = st.st_mtim.tv_sec;
+        fingerprint.mtime_nsec = st.st_mtim.tv_nsec;
+        fingerprint.valid = true;
+    }
+
+    if (fingerprint == m_fingerprint && !m_rescan)
+        return false;
+    m_fingerprint = fingerprint;
+    m_scan_generation++;
+
+    /* Shared hooks reuse the listing of another hook that scanned the folder since it changed */
+    std::vector<folder_entry> entries;
+    bool listed = false;
+    if (fingerprint.valid)
+        listed = m_reactor ? m_reactor->list_folder(folder, st, entries) : read_folder(folder, entries);
+
+    if (listed) {
+        for (const auto& ent : entries) {
+            if (!is_candidate(ent.name.c_str()))
+                continue;
+
+            std::string path = folder;
+            path += '/';
+            path += ent.name;
+
+            auto it = m_node_index.find(path);
+            if (it == m_node_index.end()) {
+                result.added.push_back({ path, ent.ino });
+                continue;
+            }
+
+            it->second.generation = m_scan_generation;
+            if (it->second.ino != ent.ino) {
+                /* Same name, but the node was recreated in between scans */
+                result.removed.emplace_back(path);
+                result.added.push_back({ path, ent.ino });
+            }
+        }
+    } else if (fingerprint.valid) {
+        gerr("Couldn't open %s", folder);
+    }
+
+    for (const auto& entry : m_node_index) {
+        if (entry.second.generation != m_scan_generation)
+            result.removed.emplace_back(entry.first);
     }
+    return true;
+}
+
+/* Opening nodes mostly waits on the kernel and USB, a few workers are plenty */
+static const size_t max_probe_workers = 4;
+
+hook_linux::scan_result hook_linux::probe_devices(bool parallel)
+{
+    std::lock_guard<std::mutex> lock(m_discovery_mutex);
+    scan_result result, queued;
+    {
+        std::lock_guard<std::mutex> index_lock(m_index_mutex);
+        if (!scan(result))
+            return queued;
+
+        /* Removed nodes go first, so a device that moved to another
+         * node is handed back after the hook thread let go of it */
+        for (const auto& path : result.removed) {
+            auto it = m_node_index.find(path);
+            auto dev = it->second.dev.lock();
+            if (dev && as_node(dev)->get_path() == path) {
+                discovery_event e;
+                e.dev = move(dev);
+                e.removed = true;
+                e.epoch = m_discovery_epoch;
+                m_discovered->push(move(e));
+                queued.removed.emplace_back(path);
+            }
+            m_node_index.erase(it);
+        }
+    }
+
+    /* Each device is queued as soon as it's open, so with workers
+     * the hook thread connects them in the order they come up */
+    const auto count = result.added.size();
+    std::vector<std::shared_ptr<device>> devices(count);
+    std::vector<char> irrelevant(count, 0);
+    auto probe = [&](size_t i) {
+        bool skip = false;
+        devices[i] = probe_node(result.added[i].path, skip);
+        irrelevant[i] = skip;
+    };
+
+    if (parallel && count > 1) {
+        std::atomic<size_t> next { 0 };
+        auto worker = [&] {
+            for (size_t i; (i = next++) < count;)
+                probe(i);
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < min(count, max_probe_workers); i++)
+            workers.emplace_back(worker);
+        worker();
+        for (auto& t : workers)
+            t.join();
+    } else {
+        for (size_t i = 0; i < count; i++)
+            probe(i);
+    }
+
+    m_rescan = false;
+    std::lock_guard<std::mutex> index_lock(m_index_mutex);
+    for (size_t i = 0; i < count; i++) {
+        const auto& n = result.added[i];
+        if (!devices[i] && !irrelevant[i]) {
+            /* Not in the index, so it's tried again on the next scan */
+            m_rescan = true;
+            continue;
+        }
+
+        auto& entry = m_node_index[n.path];
+        entry.ino = n.ino;
+        entry.dev = devices[i];
+        entry.generation = m_scan_generation;
+        if (devices[i])
+            queued.added.emplace_back(n);
+    }
+
+    /* Adopted right away instead of after the hook thread's sleep */
+    if (!queued.added.empty() || !queued.removed.empty())
+        wake_hook_thread();
+    return queued;
+}
+
+void hook_linux::update_lazy_devices()
+{
+    const auto now = device_node::now_us();
+    bool failed = false;
+
+    m_mutex.lock();
+    const bool lazy_open = m_lazy_open;
+    const auto idle_period = uint64_t(chrono::duration_cast<mcs>(m_lazy_idle_period.load()).count());
+    for (const auto& dev : m_devices) {
+        auto* node = as_node(dev);
+        const auto state = node->get_state();
+        if (!dev->is_valid() || state == node_state::STALE)
+            continue;
 
-    while ((ent = readdir(dir)) != NULL) {
-        DIR* dir2 = opendir(ent->d_name); /* NULL if not a directory */
-        if (!dir2) {
-            auto path = DEV_FOLDER + std::string("/") + std::string(ent->d_name);
-            auto path_cpy = path;
-            transform(path_cpy.begin(), path_cpy.end(), path_cpy.begin(), [](unsigned char c) { return tolower(c); });
-
-            if ((path.find("gamepad") != string::npos || path.find("joystick") != string::npos) && path.find("event") == string::npos) {
-                gdebug("Found potential gamepad at '%s'", path.c_str());
-                auto existing_dev = get_device_by_path(path);
-                auto cached_dev = m_device_cache[path];
-
-                if (existing_dev) {
-                    existing_dev->set_valid();
-                    existing_dev->init(); /* Refresh file descriptor if needed */
-                } else if (cached_dev) {
-                    cached_dev->set_valid();
-                    cached_dev->deinit();
-                    cached_dev->init();
-                    m_devices.emplace_back(cached_dev);
-                    if (m_reconnect_handler)
-                        m_reconnect_handler(cached_dev);
-                } else {
-                    auto dev = make_shared<device_linux>(path);
-                    if (dev->is_valid()) {
-                        dev->set_index(device_counter++);
-                        m_devices.emplace_back(dev);
-                        auto b = get_binding_for_device(dev->get_id());
-
-                        if (b) {
-                            dev->set_binding(move(b));
-                        } else {
-                            auto b = make_shared<cfg::binding_linux>(cfg::linux_default_binding);
-                            dev->set_binding(dynamic_pointer_cast<cfg::binding>(b));
-                        }
-                        if (m_connect_handler)
-                            m_connect_handler(dev);
-                        m_device_cache[path] = dev;
-                    }
+        const bool used = dev->take_accessed() || dev->is_subscribed();
+        if (used)
+            node->mark_used();
+
+        if ((used || !lazy_open) && state == node_state::CLOSED) {
+            node->init();
+            if (node->get_state() != node_state::OPEN) {
+                gwarn("Couldn't open '%s' on demand", node->get_path().c_str());
+                failed = true;
+                continue;
+            }
+            if (node->is_kernel_binding_pending()) {
+                /* Unless a binding was set since the device connected */
+                node->set_kernel_binding_pending(false);
+                auto current = dev->get_binding();
+                if (!current || (m_default_binding && current->get_table() == m_default_binding->get_table())) {
+                    if (auto b = static_cast<device_linux*>(node)->make_kernel_binding())
+                        dev->set_binding(move(b));
                 }
             }
-        } else {
-            closedir(dir2);
+            gdebug("Opened '%s' on demand", node->get_id().c_str());
+        } else if (lazy_open && !used && state == node_state::OPEN && now - node->get_last_used() > idle_period) {
+            /* Stays in the device list, it's only closed */
+            std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+            node->deinit();
+            gdebug("Closed idle device '%s'", node->get_id().c_str());
         }
     }
-    closedir(dir);
+
+    if (failed)
+        remove_invalid_devices();
+    m_lazy_active = lazy_open;
+    m_mutex.unlock();
 }
 
-void hook_linux::check_js()
+void hook_linux::adopt_devices()
 {
-    static const char* DEV_FOLDER = "/dev/input";
-    DIR* dir;
-    struct dirent* ent;
-    int device_counter = 0;
+    if (m_lazy_open || m_lazy_active)
+        update_lazy_devices();
 
-    if ((dir = opendir(DEV_FOLDER)) == NULL) {
-        gerr("Couldn't open %s", DEV_FOLDER);
+    /* Read before the queue, everything of the initial probe was queued before it's set */
+    const bool initial_probed = m_awaiting_ready && m_initial_probed;
+    if (m_discovered->empty()) {
+        if (initial_probed) {
+            m_awaiting_ready = false;
+            set_ready(true);
+        }
         return;
     }
 
-    while ((ent = readdir(dir)) != NULL) {
-        DIR* dir2 = opendir(ent->d_name); /* NULL if not a directory */
-        if (!dir2) {
-            auto path = DEV_FOLDER + std::string("/") + std::string(ent->d_name);
-            auto path_cpy = path;
-            transform(path_cpy.begin(), path_cpy.end(), path_cpy.begin(), [](unsigned char c) { return tolower(c); });
-
-            if (path.find("js") != std::string::npos) {
-                gdebug("Found potential gamepad at '%s'", path.c_str());
-                auto existing_dev = get_device_by_path(path);
-                auto cached_dev = m_device_cache[path];
-
-                if (existing_dev) {
-                    existing_dev->set_valid();
-                    existing_dev->init(); /* Refresh file descriptor if needed */
-                } else if (cached_dev) {
-                    gdebug("Using cached device instance");
-                    cached_dev->set_valid();
-                    cached_dev->deinit();
-                    cached_dev->init();
-                    m_devices.emplace_back(cached_dev);
-                    if (m_reconnect_handler)
-                        m_reconnect_handler(cached_dev);
-                } else {
-                    auto dev = make_shared<device_linux>(path);
-                    if (dev->is_valid()) {
-                        dev->set_index(device_counter++);
-                        m_devices.emplace_back(dev);
-                        auto b = get_binding_for_device(dev->get_id());
-
-                        if (b) {
-                            dev->set_binding(move(b));
-                        } else {
-                            auto b = make_shared<cfg::binding_linux>(cfg::linux_default_binding);
-                            dev->set_binding(dynamic_pointer_cast<cfg::binding>(b));
-                        }
-                        if (m_connect_handler)
-                            m_connect_handler(dev);
-                        m_device_cache[path] = dev;
-                    } else {
-                        gdebug("'%s' is not a valid gamepad", path.c_str());
-                    }
+    m_mutex.lock();
+    bool removed = false;
+    const auto epoch = m_discovery_epoch.load();
+    m_discovered->consume([&](discovery_event& e) {
+        if (e.epoch != epoch) {
+            drop_event(e); /* Queued before close_devices() */
+            return;
+        }
+        auto& dev = e.dev;
+        if (e.removed) {
+            /* Closed right away, the instance stays cached for a reconnect */
+            std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+            as_node(dev)->mark_stale();
+            dev->invalidate();
+            removed = true;
+            return;
+        }
+
+        add_device(dev);
+        if (e.reconnect || e.warm) {
+            /* The compiled binding is kept, unless the bindings were reloaded
+             * while the device was gone and it has a new one now */
+            auto b = get_binding_for_device(dev->get_id());
+            if (b && b != dev->get_binding())
+                dev->set_binding(move(b));
+
+            if (e.warm) {
+                dev->set_index(int(m_devices.size() - 1));
+                if (m_connect_handler)
+                    m_connect_handler(dev);
+                return;
+            }
+
+            as_node(dev)->finish_reconnect();
+            if (m_reconnect_handler)
+                m_reconnect_handler(dev);
+            return;
+        }
+
+        /* Only the custom binding lookup is left, the device is already open */
+        dev->set_index(int(m_devices.size() - 1));
+        auto b = get_binding_for_device(dev->get_id());
+        if (b)
+            as_node(dev)->set_kernel_binding_pending(false);
+        else
+            b = move(e.kernel_binding);
+        dev->set_binding(b ? move(b) : make_default_binding());
+        if (m_connect_handler)
+            m_connect_handler(dev);
+        cache_device(dev);
+    });
+
+    if (removed)
+        remove_invalid_devices();
+    m_mutex.unlock();
+
+    if (initial_probed) {
+        m_awaiting_ready = false;
+        set_ready(true);
+    }
+}
+
+void hook_linux::discovery_thread(bool initial)
+{
+    struct pollfd fd = { m_discovery_wake_fd, POLLIN, 0 };
+
+    for (;;) {
+        const bool rescan = m_rescan_requested.exchange(false);
+        if (rescan) {
+            std::lock_guard<std::mutex> lock(m_discovery_mutex);
+            m_rescan = true;
+        }
+
+        if (initial) {
+            probe_devices(true);
+            m_initial_probed = true;
+            initial = false;
+            wake_hook_thread();
+        } else if (m_plug_and_play || rescan) {
+            probe_devices();
+        }
+
+        auto timeout = chrono::duration_cast<ms>(m_plug_and_play_interval.load()).count();
+        auto result = poll(&fd, 1, int(timeout));
+        if (result < 0 && errno != EINTR) {
+            gerr("Polling discovery wake descriptor failed: %s", strerror(errno));
+            break;
+        }
+        if (result > 0)
+            break;
+    }
+}
+
+void hook_linux::start_discovery(bool initial)
+{
+    if (m_discovery_thread.joinable() || m_discovery_shared)
+        return;
+    if (m_reactor) {
+        /* Same passes as discovery_thread(), run by the reactor's discovery thread */
+        m_reactor->add_discovery(
+            this,
+            [this, initial]() mutable {
+                const bool rescan = m_rescan_requested.exchange(false);
+                if (rescan) {
+                    std::lock_guard<std::mutex> lock(m_discovery_mutex);
+                    m_rescan = true;
+                }
+
+                if (initial) {
+                    probe_devices(true);
+                    m_initial_probed = true;
+                    initial = false;
+                    wake_hook_thread();
+                } else if (m_plug_and_play || rescan) {
+                    probe_devices();
                 }
+            },
+            m_plug_and_play_interval);
+        m_discovery_shared = true;
+        return;
+    }
+
+    m_discovery_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_discovery_wake_fd < 0) {
+        gerr("Couldn't create eventfd: %s", strerror(errno));
+        return;
+    }
+    m_discovery_thread = thread(&hook_linux::discovery_thread, this, initial);
+}
+
+void hook_linux::stop_discovery()
+{
+    if (m_discovery_shared) {
+        m_reactor->remove_discovery(this);
+        m_discovery_shared = false;
+    }
+
+    if (m_discovery_thread.joinable()) {
+        uint64_t one = 1;
+        if (write(m_discovery_wake_fd, &one, sizeof(one)) != sizeof(one))
+            gerr("Couldn't wake discovery thread");
+        m_discovery_thread.join();
+    }
+
+    if (m_discovery_wake_fd >= 0)
+        close(m_discovery_wake_fd);
+    m_discovery_wake_fd = -1;
+}
+
+void hook_linux::restart_discovery()
+{
+    /* A probe pass that's running finishes first */
+    std::lock_guard<std::mutex> lock(m_discovery_start_mutex);
+    stop_discovery();
+    const bool initial = m_awaiting_ready && !m_initial_probed;
+    if (m_plug_and_play || initial || m_rescan_requested)
+        start_discovery(initial);
+}
+
+void hook_linux::wake_hook_thread()
+{
+    if (eventfd_write(m_control_fd, 1) < 0)
+        gerr("Couldn't wake hook thread: %s", strerror(errno));
+}
+
+void hook_linux::apply_control(const control& c)
+{
+    switch (c.kind) {
+    case control::PLUG_AND_PLAY:
+    case control::RESCAN:
+        /* Pumped hooks probe on folder changes, there's no discovery to restart */
+        if (m_pumped) {
+            if (c.kind == control::RESCAN) {
+                {
+                    std::lock_guard<std::mutex> lock(m_discovery_mutex);
+                    m_rescan = true;
+                }
+                probe_devices();
             }
-        } else {
-            closedir(dir2);
+            return;
+        }
+        if (c.kind == control::RESCAN)
+            m_rescan_requested = true;
+        restart_discovery();
+        return;
+    case control::PAUSE: {
+        /* Suspended devices aren't watched by the engine, wait_for_input
+         * attaches them again once the hook is resumed */
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_paused = true;
+        for (const auto& dev : m_devices) {
+            auto* node = as_node(dev);
+            std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+            if (node->get_engine())
+                node->get_engine()->suspend(node);
         }
+        return;
+    }
+    default:
+        hook::apply_control(c);
     }
-    closedir(dir);
+}
+
+void hook_linux::apply_enabled(const std::shared_ptr<device>& dev, bool enabled)
+{
+    /* Same as pausing, but only for this device */
+    auto* node = as_node(dev);
+    if (!enabled && node->get_engine())
+        node->get_engine()->suspend(node);
+    hook::apply_enabled(dev, enabled);
+}
+
+void hook_linux::catch_up(const std::shared_ptr<device>& dev)
+{
+    /* Shared nodes were read for the other hooks meanwhile, so the device
+     * subscribes again before it catches up and loads the current state */
+    auto* node = as_node(dev);
+    if (m_reactor && m_engine && node->get_state() == node_state::OPEN && !node->get_engine()
+        && m_engine->attach(node) && m_resume_policy == resume_policy::DRAIN)
+        node->reload_state();
+    hook::catch_up(dev);
+}
+
+bool hook_linux::adopts_on_this_thread() const
+{
+    if (m_running)
+        return this_thread::get_id() == m_hook_thread.get_id();
+    return !m_pumped;
+}
+
+hook_linux::scan_result hook_linux::discover()
+{
+    auto result = probe_devices();
+    if (adopts_on_this_thread())
+        adopt_devices();
+    else
+        wake_hook_thread();
+    return result;
 }
 
 void hook_linux::query_devices()
+{
+    discover();
+}
+
+void hook_linux::drop_event(discovery_event& e)
+{
+    /* The probe opened the device, cached instances would stay open outside
+     * the device list and couldn't be reopened by the next scan */
+    if (!e.removed)
+        e.dev->deinit();
+}
+
+void hook_linux::close_devices()
 {
     m_mutex.lock();
-    /* Invalidate all devices so we can check later, which one
-     * are still connected/newly connected and which ones were
-     * disconnected
-     */
-    for (auto& dev : m_devices)
-        dev->invalidate();
+    for (auto& dev : m_devices) {
+        std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+        dev->deinit();
+    }
+    m_mutex.unlock();
+    hook::close_devices();
 
-    if (m_flags & hook_type::JS)
-        check_js();
-    else
-        check_dev_by_id();
+    /* Devices that weren't handed over yet are dropped by whoever adopts
+     * them next and the next query starts from scratch */
+    std::lock_guard<std::mutex> lock(m_discovery_mutex);
+    m_discovery_epoch++;
+    if (adopts_on_this_thread())
+        m_discovered->consume(drop_event);
+    std::lock_guard<std::mutex> index_lock(m_index_mutex);
+    m_node_index.clear();
+    m_fingerprint = folder_fingerprint();
+    m_rescan = false;
+}
+
+bool hook_linux::start_async()
+{
+    if (m_running)
+        return true;
+    if (m_pumped) {
+        gerr("The hook is already pumped, it can't start its thread");
+        return false;
+    }
+
+    /* The discovery thread is started first, so the hook thread doesn't start another one */
+    m_initial_probed = false;
+    m_awaiting_ready = true;
+    {
+        std::lock_guard<std::mutex> lock(m_discovery_start_mutex);
+        start_discovery(true);
+        if (!m_discovery_thread.joinable() && !m_discovery_shared)
+            m_awaiting_ready = false;
+    }
+    if (!m_awaiting_ready)
+        return start();
 
-    remove_invalid_devices();
+    m_running = true;
+    m_hook_thread = thread(default_hook_thread, this);
+    return true;
+}
+
+bool hook_linux::start()
+{
+    if (!hook::start())
+        return false;
+
+    /* Later plug and play changes restart discovery through a control */
+    std::lock_guard<std::mutex> lock(m_discovery_start_mutex);
+    if (m_plug_and_play && !m_pumped)
+        start_discovery();
+    return true;
+}
+
+void hook_linux::stop()
+{
+    /* The hook thread restarts the discovery thread, so it has to end first */
+    if (m_running) {
+        post_control(control::STOP);
+        m_running = false;
+        m_hook_thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_discovery_start_mutex);
+        stop_discovery();
+    }
+    stop_pump();
+    m_awaiting_ready = false;
+    hook::stop();
+}
+
+bool hook_linux::start_pump()
+{
+    if (m_pumped)
+        return true;
+    if (m_running) {
+        gerr("The hook thread is running, the hook can't be pumped");
+        return false;
+    }
+    if (m_reactor) {
+        gerr("Shared hooks are read by the reactor thread and can't be pumped");
+        return false;
+    }
+    if (!m_engine && !set_io_engine(io_engine_type::EPOLL))
+        return false;
+    if (m_engine->get_fd() < 0) {
+        gerr("The io engine reads on its own threads, pump mode needs epoll or io_uring");
+        return false;
+    }
+
+    m_pump_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_pump_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_pump_fd < 0 || m_pump_wake_fd < 0) {
+        gerr("Couldn't create pump descriptors: %s", strerror(errno));
+        stop_pump();
+        return false;
+    }
+
+    /* Nodes appearing, disappearing or getting their permissions from udev */
+    const char* folder = device_folder();
+    m_hotplug_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_hotplug_fd >= 0
+        && inotify_add_watch(m_hotplug_fd, folder, IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+        gwarn("Couldn't watch '%s', devices are only found by query_devices(): %s", folder, strerror(errno));
+        close(m_hotplug_fd);
+        m_hotplug_fd = -1;
+    }
+
+    for (const auto fd : { m_engine->get_fd(), m_pump_wake_fd, m_hotplug_fd, m_control_fd }) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (fd >= 0 && epoll_ctl(m_pump_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            gerr("Couldn't add descriptor to the pump set: %s", strerror(errno));
+            stop_pump();
+            return false;
+        }
+    }
+
+    /* Set first, so adopting the initial devices doesn't start the discovery thread */
+    m_pumped = true;
+    query_devices();
+    set_ready(true);
+    return true;
+}
+
+void hook_linux::stop_pump()
+{
+    for (auto* fd : { &m_pump_fd, &m_pump_wake_fd, &m_hotplug_fd }) {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+int hook_linux::pump(int max_events)
+{
+    if (!m_pumped)
+        return 0;
+
+    /* Controls are applied by hook::pump() */
+    eventfd_t pending;
+    eventfd_read(m_pump_wake_fd, &pending);
+    eventfd_read(m_control_fd, &pending);
+
+    /* The scan compares the folder fingerprint, so a burst of changes is one probe pass */
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+    while (m_hotplug_fd >= 0 && read(m_hotplug_fd, buf, sizeof(buf)) > 0)
+        changed = true;
+    if (changed && m_plug_and_play)
+        probe_devices();
+
+    const int events = hook::pump(max_events);
+    if (m_pump_backlog || !m_discovered->empty())
+        eventfd_write(m_pump_wake_fd, 1);
+    return events;
+}
+
+bool hook_linux::set_io_engine(io_engine_type::type type, unsigned threads)
+{
+    if (m_running) {
+        gerr("The io engine can't be changed while the hook is running");
+        return false;
+    }
+    if (m_reactor) {
+        gerr("Shared hooks always get their input from the shared reactor");
+        return false;
+    }
+
+    std::unique_ptr<io_engine> engine;
+    if (type != io_engine_type::READ) {
+        engine = io_engine::make(
+            type,
+            [this](const std::weak_ptr<device_node>& node, const std::atomic<bool>& detached, const void* data,
+                ssize_t len) { dispatch_device(node, detached, data, len); },
+            threads);
+        if (!engine) {
+            gerr("Requested io engine isn't available");
+            return false;
+        }
+    }
+
+    /* Devices attached to the old engine read on their own until the hook thread attaches
+     * them again. Reader threads might wait for an input mutex, so the old engine is
+     * destroyed after they're released */
+    m_mutex.lock();
+    for (const auto& dev : m_devices) {
+        auto* node = as_node(dev);
+        std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+        if (node->get_engine())
+            node->get_engine()->detach(node);
+    }
+    swap(m_engine, engine);
     m_mutex.unlock();
+    engine.reset();
+
+    static const char* names[] = { "reads on every iteration", "epoll", "io_uring", "a thread per device",
+        "sharded io threads" };
+    ginfo("Using %s for device input", names[get_io_engine()]);
+    return true;
+}
+
+io_engine_type::type hook_linux::get_io_engine() const
+{
+    return m_engine ? m_engine->type() : io_engine_type::READ;
+}
+
+void hook_linux::dispatch_device(
+    const std::weak_ptr<device_node>& node, const std::atomic<bool>& detached, const void* data, ssize_t len)
+{
+    /* The hook thread holds the input mutex while it closes, suspends or switches
+     * the engine of a device, so detached can't change while it's held here */
+    const auto dev = node.lock();
+    if (!dev)
+        return;
+    std::lock_guard<std::mutex> lock(*dev->get_input_mutex());
+    if (detached)
+        return;
+
+    if (len < 0)
+        dev->set_read_error(int(-len));
+    else if (data)
+        dev->feed(data, size_t(len));
+    else
+        dev->set_readable();
+    /* Input read before the device was suspended waits for catch_up() */
+    if (!m_paused && dev->is_read_enabled())
+        update_device(dev);
+}
+
+bool hook_linux::wait_for_input(ns timeout)
+{
+    const bool watch_devices = m_engine && !m_paused;
+    int engine_fd = -1;
+    if (watch_devices) {
+        attach_devices();
+
+        /* This also submits the reads io_uring posts again */
+        if (m_engine->wait(ns(0)))
+            return true;
+        engine_fd = m_engine->get_fd();
+    }
+
+    /* Engines with a descriptor are waited on together with the controls,
+     * the others dispatch on their own threads */
+    struct pollfd fds[2] = { { m_control_fd, POLLIN, 0 }, { engine_fd, POLLIN, 0 } };
+    struct timespec ts = { time_t(timeout.count() / 1000000000), long(timeout.count() % 1000000000) };
+    const auto result = ppoll(fds, engine_fd >= 0 ? 2 : 1, timeout == ns::max() ? nullptr : &ts, nullptr);
+    if (result < 0 && errno != EINTR)
+        gerr("Waiting for input failed: %s", strerror(errno));
+
+    eventfd_t posted;
+    if (result > 0 && fds[0].revents)
+        eventfd_read(m_control_fd, &posted);
+    if (watch_devices && (engine_fd < 0 || (result > 0 && fds[1].revents)))
+        m_engine->wait(ns(0));
+    return result != 0;
+}
+
+bool hook_linux::poll_input()
+{
+    if (hook::poll_input())
+        return true;
+    if (m_engine)
+        return m_engine->wait(ns(0));
+
+    std::vector<struct pollfd> fds;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fds.reserve(m_devices.size());
+        for (const auto& dev : m_devices) {
+            auto* node = as_node(dev);
+            if (node->get_state() != node_state::OPEN || !dev->is_read_enabled())
+                continue;
+            if (dev->has_pending())
+                return true;
+            fds.push_back({ node->get_fd(), POLLIN, 0 });
+        }
+    }
+    return !fds.empty() && poll(fds.data(), fds.size(), 0) > 0;
+}
+
+bool hook_linux::start_spin()
+{
+    if (!m_engine)
+        return true;
+    if (m_engine->get_fd() < 0)
+        return false;
+    attach_devices();
+    return true;
+}
+
+void hook_linux::attach_devices()
+{
+    /* Devices that were opened since the last iteration are attached before waiting,
+     * until then update() reads them on its own, so no input is missed */
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& dev : m_devices) {
+        auto* node = as_node(dev);
+        if (node->get_state() != node_state::OPEN || node->get_engine() || !dev->is_read_enabled())
+            continue;
+        /* Threads might still feed it input that was read before it was suspended */
+        std::lock_guard<std::mutex> input_lock(*dev->get_input_mutex());
+        m_engine->attach(node);
+    }
+}
+
+bool hook_linux::save_warm_state(const std::string& path)
+{
+    warm_state::state state;
+    state.flags = m_flags;
+    std::unordered_map<const cfg::binding*, uint32_t> custom;
+    std::unordered_map<const cfg::mapping_table*, uint32_t> tables;
+
+    auto add_binding = [&](const std::shared_ptr<cfg::binding>& b, bool is_custom) {
+        warm_state::binding_entry entry;
+        const auto table = b->get_table();
+        entry.name = b->get_name();
+        entry.custom = is_custom;
+        entry.buttons = table->buttons;
+        entry.axis = table->axis;
+        state.bindings.emplace_back(move(entry));
+        return uint32_t(state.bindings.size() - 1);
+    };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& b : m_bindings)
+        custom[b.get()] = add_binding(b, true);
+    for (const auto& m : m_binding_map)
+        state.binding_map.emplace_back(m.first, m.second);
+
+    for (const auto& cached : m_device_cache) {
+        auto* node = as_node(cached.second);
+
+        /* Without a sysfs identity there's nothing to check the entry against */
+        if (node->get_cache_id() == node->get_path())
+            continue;
+
+        warm_state::device_entry entry;
+        entry.cache_id = node->get_cache_id();
+        entry.path = node->get_path();
+        entry.name = node->get_name();
+
+        /* Kernel and default bindings are stored once per distinct table */
+        if (auto b = node->get_binding()) {
+            auto it = custom.find(b.get());
+            if (it != custom.end()) {
+                entry.binding = it->second;
+            } else {
+                auto table = tables.find(b->get_table().get());
+                if (table == tables.end())
+                    table = tables.emplace(b->get_table().get(), add_binding(b, false)).first;
+                entry.binding = table->second;
+            }
+        }
+
+        if (m_flags & hook_type::EVDEV) {
+            auto* ev = static_cast<device_evdev*>(node);
+            entry.key_codes = ev->get_key_codes();
+            for (const auto code : ev->get_abs_codes())
+                entry.abs.emplace_back(code, ev->get_absinfo(code));
+        } else {
+            const auto& caps = static_cast<device_linux*>(node)->get_capabilities();
+            entry.axes = caps.axes;
+            entry.buttons = caps.buttons;
+            entry.axis_codes = caps.axis_codes;
+            entry.button_codes = caps.button_codes;
+        }
+        state.devices.emplace_back(move(entry));
+    }
+
+    return warm_state::save(path, state);
+}
+
+bool hook_linux::load_warm_state(const std::string& path)
+{
+    warm_state::state state;
+    if (!warm_state::load(path, state))
+        return false;
+
+    if (state.flags != m_flags) {
+        ginfo("Warm state in '%s' is for another hook type, ignoring it", path.c_str());
+        return false;
+    }
+
+    std::vector<std::shared_ptr<cfg::binding>> bindings;
+    for (const auto& entry : state.bindings) {
+        auto b = make_shared<cfg::binding_linux>();
+        b->set_name(entry.name);
+        b->edit().buttons = entry.buttons;
+        b->edit().axis = entry.axis;
+        b->commit();
+        bindings.emplace_back(move(b));
+    }
+
+    /* Identities are read before taking the lock, the entry is only
+     * used if the node still belongs to the same gamepad */
+    std::vector<bool> valid(state.devices.size());
+    size_t discarded = 0;
+    for (size_t i = 0; i < state.devices.size(); i++) {
+        sysfs::identity identity;
+        valid[i] = sysfs::read_identity(state.devices[i].path, identity) && identity.key() == state.devices[i].cache_id;
+        discarded += !valid[i];
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < bindings.size(); i++) {
+        if (state.bindings[i].custom) {
+            add_binding(bindings[i]);
+            bindings[i] = get_binding_by_name(bindings[i]->get_name());
+        }
+    }
+
+    /* Mappings that were loaded from json take precedence */
+    for (const auto& m : state.binding_map)
+        m_binding_map.emplace(m.first, m.second);
+
+    size_t restored = 0;
+    for (size_t i = 0; i < state.devices.size(); i++) {
+        const auto& entry = state.devices[i];
+        if (!valid[i] || m_device_cache.count(entry.cache_id))
+            continue;
+
+        std::shared_ptr<device_node> dev;
+        if (m_flags & hook_type::EVDEV) {
+            auto ev = make_shared<device_evdev>(entry.path, false);
+            ev->set_reactor(m_reactor);
+            ev->seed_capabilities(entry.key_codes, entry.abs);
+            dev = ev;
+        } else {
+            js_capabilities caps;
+            caps.name = entry.name;
+            caps.axes = entry.axes;
+            caps.buttons = entry.buttons;
+            caps.axis_codes = entry.axis_codes;
+            caps.button_codes = entry.button_codes;
+            auto js = make_shared<device_linux>(entry.path, false);
+            js->set_reactor(m_reactor);
+            js->seed_capabilities(caps);
+            dev = js;
+        }
+
+        dev->set_cache_id(entry.cache_id);
+        if (entry.binding != UINT32_MAX) {
+            const auto& b = bindings[entry.binding];
+            dev->set_binding(state.bindings[entry.binding].custom ? b : b->clone());
+        }
+
+        m_device_cache[entry.cache_id] = dev;
+        m_warm_devices[entry.cache_id] = dev;
+        restored++;
+    }
+
+    gdebug("Restored %zu devices from '%s', discarded %zu stale ones", restored, path.c_str(), discarded);
+    return true;
 }
 
 shared_ptr<cfg::binding> hook_linux::make_native_binding(const Json& j)
@@ -193,6 +1215,8 @@ shared_ptr<cfg::binding> hook_linux::make_native_binding(const Json& j)
 
 const Json& hook_linux::get_default_binding()
 {
+    if (m_flags & hook_type::EVDEV)
+        return cfg::evdev_default_binding;
     return cfg::linux_default_binding;
 }
 
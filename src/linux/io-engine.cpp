@@ -0,0 +1,870 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "io-engine.hpp"
+#include "device-node.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <gamepad/log.hpp>
+#include <linux/input.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace gamepad {
+
+/* Bytes read per device and read, a full evdev batch or 192 js events */
+static const size_t IO_READ_SIZE = 64 * sizeof(struct ::input_event);
+
+/* Level triggered epoll, devices are flagged readable and update() reads
+ * them until they'd block, which clears the flag again */
+class io_engine_epoll : public io_engine {
+    int m_epoll_fd = -1;
+    std::vector<device_node*> m_slots;
+    std::vector<int> m_free_slots;
+    std::vector<struct epoll_event> m_events;
+
+public:
+    io_engine_epoll() { m_epoll_fd = epoll_create1(EPOLL_CLOEXEC); }
+
+    ~io_engine_epoll()
+    {
+        for (auto* dev : m_slots) {
+            if (dev)
+                dev->set_io(nullptr, -1, io_mode::SELF);
+        }
+        if (m_epoll_fd >= 0)
+            close(m_epoll_fd);
+    }
+
+    bool valid() const { return m_epoll_fd >= 0; }
+
+    io_engine_type::type type() const override { return io_engine_type::EPOLL; }
+    int get_fd() const override { return m_epoll_fd; }
+
+    bool attach(device_node* dev) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int slot;
+        if (m_free_slots.empty()) {
+            slot = int(m_slots.size());
+            m_slots.emplace_back(nullptr);
+        } else {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = uint64_t(slot);
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, dev->get_fd(), &ev) < 0) {
+            gwarn("Couldn't watch '%s' with epoll: %s", dev->get_path().c_str(), strerror(errno));
+            m_free_slots.emplace_back(slot);
+            return false;
+        }
+        m_slots[slot] = dev;
+        dev->set_io(this, slot, io_mode::NOTIFIED);
+        return true;
+    }
+
+    void detach(device_node* dev) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto slot = dev->get_io_slot();
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, dev->get_fd(), nullptr);
+        m_slots[slot] = nullptr;
+        m_free_slots.emplace_back(slot);
+        dev->set_io(nullptr, -1, io_mode::SELF);
+    }
+
+    bool wait(std::chrono::nanoseconds timeout) override
+    {
+        /* epoll_wait only takes milliseconds, round up so short timeouts don't spin */
+        const auto ms = int((timeout.count() + 999999) / 1000000);
+        m_events.resize(std::max<size_t>(m_slots.size(), 1));
+        const auto count = epoll_wait(m_epoll_fd, m_events.data(), int(m_events.size()), ms);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int i = 0; i < count; i++) {
+            const auto slot = size_t(m_events[i].data.u64);
+            /* A slot that was reused since only gets a spurious read attempt */
+            if (slot < m_slots.size() && m_slots[slot])
+                m_slots[slot]->set_readable();
+        }
+        return count > 0;
+    }
+};
+
+/* io_uring through the raw syscalls. Every attached device has a read posted
+ * into a buffer owned by its slot, completions are copied into the device
+ * with feed() and the read is posted again. The reposts are submitted by the
+ * same io_uring_enter() that waits for the next completions, so an idle
+ * device costs no syscalls at all */
+class io_engine_uring : public io_engine {
+    static const uint64_t CANCEL_TAG = 1ull << 63;
+    static const unsigned RING_ENTRIES = 256;
+
+    struct slot {
+        device_node* dev = nullptr;
+        int fd = -1;
+        int fd_flags = 0;
+        bool in_flight = false;
+        bool suspended = false; /* Only collects the reads that complete until it's detached */
+        std::unique_ptr<uint8_t[]> buffer;
+    };
+
+    int m_ring_fd = -1;
+    void* m_sq_ring = nullptr;
+    void* m_cq_ring = nullptr;
+    size_t m_sq_ring_size = 0, m_cq_ring_size = 0;
+    struct io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqes_size = 0;
+
+    unsigned *m_sq_head = nullptr, *m_sq_tail = nullptr, *m_sq_mask = nullptr, *m_sq_array = nullptr;
+    unsigned *m_cq_head = nullptr, *m_cq_tail = nullptr, *m_cq_mask = nullptr;
+    unsigned m_sq_entries = 0;
+    struct io_uring_cqe* m_cqes = nullptr;
+
+    std::vector<slot> m_slots;
+    std::vector<int> m_free_slots;
+
+    static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t size)
+    {
+        return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size));
+    }
+
+    static unsigned load(const unsigned* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+    static void store(unsigned* p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+    unsigned unsubmitted() const { return *m_sq_tail - load(m_sq_head); }
+
+    /* Called with the mutex held, submits right away if the queue is full */
+    struct io_uring_sqe* next_sqe()
+    {
+        if (unsubmitted() == m_sq_entries && enter(m_ring_fd, unsubmitted(), 0, 0, nullptr, 0) < 0)
+            return nullptr;
+
+        const auto tail = *m_sq_tail;
+        const auto index = tail & *m_sq_mask;
+        auto* sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        return sqe;
+    }
+
+    void commit_sqe() { store(m_sq_tail, *m_sq_tail + 1); }
+
+    /* Submits what's queued and waits up to 10ms for a completion */
+    void wait_completion()
+    {
+        struct __kernel_timespec ts = { 0, 10000000 };
+        struct io_uring_getevents_arg arg = {};
+        arg.ts = uint64_t(uintptr_t(&ts));
+        enter(m_ring_fd, unsubmitted(), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    bool post_read(int index)
+    {
+        auto& s = m_slots[index];
+        auto* sqe = next_sqe();
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = s.fd;
+        sqe->addr = uint64_t(uintptr_t(s.buffer.get()));
+        sqe->len = IO_READ_SIZE;
+        sqe->off = uint64_t(-1); /* Current file position, character devices don't have one */
+        sqe->user_data = uint64_t(index);
+        commit_sqe();
+        s.in_flight = true;
+        return true;
+    }
+
+    void post_cancel(int index)
+    {
+        auto* sqe = next_sqe();
+        if (!sqe)
+            return;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = uint64_t(index);
+        sqe->user_data = CANCEL_TAG | uint64_t(index);
+        commit_sqe();
+    }
+
+    void release(int index)
+    {
+        auto& s = m_slots[index];
+        s.dev = nullptr;
+        s.fd = -1;
+        s.suspended = false;
+        m_free_slots.emplace_back(index);
+    }
+
+    /* Takes all completions off the ring, called with the mutex held */
+    size_t harvest()
+    {
+        auto head = *m_cq_head;
+        const auto tail = load(m_cq_tail);
+        size_t count = 0;
+
+        for (; head != tail; head++, count++) {
+            const auto& cqe = m_cqes[head & *m_cq_mask];
+            if (cqe.user_data & CANCEL_TAG)
+                continue;
+
+            const auto index = int(cqe.user_data);
+            auto& s = m_slots[index];
+            s.in_flight = false;
+
+            if (!s.dev) {
+                /* Detached while the read was posted, the buffer is free now */
+                release(index);
+            } else if (cqe.res > 0) {
+                s.dev->feed(s.buffer.get(), size_t(cqe.res));
+                if (!s.suspended)
+                    post_read(index);
+            } else if (s.suspended) {
+                /* Cancelled, the device reads on its own again */
+            } else if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                post_read(index);
+            } else {
+                /* The next update() sees the error, e.g. ENODEV once the gamepad is unplugged */
+                s.dev->set_read_error(cqe.res < 0 ? -cqe.res : EIO);
+            }
+        }
+        store(m_cq_head, head);
+        return count;
+    }
+
+public:
+    io_engine_uring()
+    {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        m_ring_fd = int(syscall(__NR_io_uring_setup, RING_ENTRIES, &p));
+        if (m_ring_fd < 0) {
+            gdebug("io_uring isn't available: %s", strerror(errno));
+            return;
+        }
+
+        /* Waiting with a timeout needs the extended enter arguments of Linux 5.11 */
+        if (!(p.features & IORING_FEAT_EXT_ARG)) {
+            gdebug("io_uring is too old, it can't wait with a timeout");
+            close(m_ring_fd);
+            m_ring_fd = -1;
+            return;
+        }
+
+        m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+
+        m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+            IORING_OFF_SQ_RING);
+        m_cq_ring = single ? m_sq_ring
+                           : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               m_ring_fd, IORING_OFF_CQ_RING);
+        m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = static_cast<struct io_uring_sqe*>(mmap(
+            nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+
+        if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED) {
+            gerr("Couldn't map io_uring rings: %s", strerror(errno));
+            unmap();
+            return;
+        }
+
+        auto* sq = static_cast<uint8_t*>(m_sq_ring);
+        auto* cq = static_cast<uint8_t*>(m_cq_ring);
+        m_sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        m_sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        m_sq_entries = p.sq_entries;
+        m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        m_cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    }
+
+    ~io_engine_uring()
+    {
+        if (m_ring_fd < 0)
+            return;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        size_t in_flight = 0;
+        for (size_t i = 0; i < m_slots.size(); i++) {
+            auto& s = m_slots[i];
+            if (s.dev)
+                restore(s);
+            if (s.in_flight) {
+                post_cancel(int(i));
+                in_flight++;
+            }
+            s.dev = nullptr;
+        }
+
+        /* The kernel may only write into the buffers until their reads are
+         * cancelled, so wait for that before they're freed */
+        for (int tries = 0; in_flight > 0 && tries < 10; tries++) {
+            wait_completion();
+            harvest();
+            in_flight = 0;
+            for (const auto& s : m_slots)
+                in_flight += s.in_flight;
+        }
+        if (in_flight > 0)
+            gwarn("%zu io_uring reads weren't cancelled", in_flight);
+        unmap();
+    }
+
+    void unmap()
+    {
+        if (m_sqes && m_sqes != MAP_FAILED)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring && m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+            munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring && m_sq_ring != MAP_FAILED)
+            munmap(m_sq_ring, m_sq_ring_size);
+        m_sqes = nullptr;
+        m_sq_ring = m_cq_ring = nullptr;
+        close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+
+    bool valid() const { return m_ring_fd >= 0; }
+
+    /* Polls readable while the completion queue has entries */
+    int get_fd() const override { return m_ring_fd; }
+
+    io_engine_type::type type() const override { return io_engine_type::IO_URING; }
+
+    /* Posted reads on a non blocking descriptor complete right away with
+     * EAGAIN, so it's switched to blocking while it's attached */
+    static void restore(slot& s)
+    {
+        fcntl(s.fd, F_SETFL, s.fd_flags);
+        s.dev->set_io(nullptr, -1, io_mode::SELF);
+    }
+
+    bool attach(device_node* dev) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int index;
+        if (m_free_slots.empty()) {
+            index = int(m_slots.size());
+            m_slots.emplace_back();
+            m_slots.back().buffer.reset(new uint8_t[IO_READ_SIZE]);
+        } else {
+            index = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+
+        auto& s = m_slots[index];
+        s.dev = dev;
+        s.fd = dev->get_fd();
+        s.fd_flags = fcntl(s.fd, F_GETFL);
+        if (s.fd_flags < 0 || fcntl(s.fd, F_SETFL, s.fd_flags & ~O_NONBLOCK) < 0 || !post_read(index)) {
+            gwarn("Couldn't attach '%s' to io_uring", dev->get_path().c_str());
+            if (s.fd_flags >= 0)
+                fcntl(s.fd, F_SETFL, s.fd_flags);
+            release(index);
+            return false;
+        }
+        dev->set_io(this, index, io_mode::FED);
+        return true;
+    }
+
+    void detach(device_node* dev) override { remove(dev, false); }
+    void suspend(device_node* dev) override { remove(dev, true); }
+
+    void remove(device_node* dev, bool keep_input)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto index = dev->get_io_slot();
+        auto& s = m_slots[index];
+
+        /* The slot is released once the cancelled read completes, submit the
+         * cancel right away so the kernel drops its reference to the node */
+        if (s.in_flight) {
+            post_cancel(index);
+            enter(m_ring_fd, unsubmitted(), 0, 0, nullptr, 0);
+        }
+
+        /* A read can still complete with input before its cancel does, that's
+         * waited for, so a suspended device catches up on everything */
+        if (keep_input) {
+            s.suspended = true;
+            harvest();
+            for (int tries = 0; s.in_flight && tries < 10; tries++) {
+                wait_completion();
+                harvest();
+            }
+        }
+
+        restore(s);
+        s.dev = nullptr;
+        if (!s.in_flight)
+            release(index);
+    }
+
+    bool wait(std::chrono::nanoseconds timeout) override
+    {
+        unsigned to_submit;
+        size_t harvested;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            harvested = harvest();
+            if (harvested > 0)
+                timeout = std::chrono::nanoseconds(0);
+            to_submit = unsubmitted();
+        }
+
+        if (timeout.count() > 0 || to_submit > 0) {
+            struct __kernel_timespec ts;
+            ts.tv_sec = timeout.count() / 1000000000;
+            ts.tv_nsec = timeout.count() % 1000000000;
+            struct io_uring_getevents_arg arg = {};
+            arg.ts = uint64_t(uintptr_t(&ts));
+            const unsigned flags = timeout.count() > 0 ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+            enter(m_ring_fd, to_submit, timeout.count() > 0, flags, flags ? &arg : nullptr, flags ? sizeof(arg) : 0);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        harvested += harvest();
+        return harvested > 0;
+    }
+};
+
+/* A thread per device that sleeps in poll() until the device or its wake eventfd
+ * is readable. Detached readers are only joined later, since the thread might be
+ * waiting for the input mutex the caller of detach() holds, or be the caller */
+class io_engine_threads : public io_engine {
+    struct reader {
+        device_node* dev; /* Only used by the hook thread, readers go through owner */
+        std::weak_ptr<device_node> owner;
+        std::string path;
+        int fd;
+        int wake_fd;
+        std::atomic<bool> stop { false };
+        std::atomic<bool> done { false };
+        std::thread thread;
+    };
+
+    io_dispatch m_dispatch;
+    std::vector<std::shared_ptr<reader>> m_readers;
+    std::vector<std::shared_ptr<reader>> m_retired;
+    std::vector<int> m_free_slots;
+
+    static void run(std::shared_ptr<reader> r, const io_dispatch* dispatch)
+    {
+        struct pollfd fds[2] = { { r->fd, POLLIN, 0 }, { r->wake_fd, POLLIN, 0 } };
+        while (!r->stop) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                gerr("Reader thread of '%s' failed: %s", r->path.c_str(), strerror(errno));
+                break;
+            }
+            if (r->stop || fds[1].revents)
+                break;
+
+            if (fds[0].revents)
+                (*dispatch)(r->owner, r->stop, nullptr, 0);
+            /* Unplugged, poll() won't block on the node anymore */
+            if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+                break;
+        }
+        r->done = true;
+    }
+
+    static void join(reader& r)
+    {
+        r.thread.join();
+        close(r.wake_fd);
+    }
+
+    /* Called with the mutex held */
+    void reap()
+    {
+        for (auto it = m_retired.begin(); it != m_retired.end();) {
+            if ((*it)->done) {
+                join(**it);
+                it = m_retired.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+public:
+    io_engine_threads(io_dispatch dispatch)
+        : m_dispatch(std::move(dispatch))
+    {
+    }
+
+    ~io_engine_threads()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& r : m_readers) {
+            if (!r)
+                continue;
+            r->dev->set_io(nullptr, -1, io_mode::SELF);
+            r->stop = true;
+            eventfd_write(r->wake_fd, 1);
+            m_retired.emplace_back(r);
+        }
+        for (auto& r : m_retired)
+            join(*r);
+    }
+
+    io_engine_type::type type() const override { return io_engine_type::THREAD_PER_DEVICE; }
+
+    bool attach(device_node* dev) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reap();
+
+        auto r = std::make_shared<reader>();
+        r->dev = dev;
+        r->owner = dev->shared_from_this();
+        r->path = dev->get_path();
+        r->fd = dev->get_fd();
+        r->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (r->wake_fd < 0) {
+            gwarn("Couldn't create reader thread for '%s': %s", dev->get_path().c_str(), strerror(errno));
+            return false;
+        }
+
+        int slot;
+        if (m_free_slots.empty()) {
+            slot = int(m_readers.size());
+            m_readers.emplace_back();
+        } else {
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+        m_readers[slot] = r;
+
+        /* The device only reads once its reader saw input, see dispatch */
+        dev->set_io(this, slot, io_mode::NOTIFIED);
+        r->thread = std::thread(run, r, &m_dispatch);
+        return true;
+    }
+
+    void detach(device_node* dev) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto slot = dev->get_io_slot();
+        auto r = m_readers[slot];
+        m_readers[slot] = nullptr;
+        m_free_slots.emplace_back(slot);
+        dev->set_io(nullptr, -1, io_mode::SELF);
+
+        r->stop = true;
+        eventfd_write(r->wake_fd, 1);
+        m_retired.emplace_back(r);
+    }
+
+    bool wait(std::chrono::nanoseconds timeout) override
+    {
+        /* Input never goes through the hook thread */
+        std::this_thread::sleep_for(timeout);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reap();
+        return false;
+    }
+};
+
+/* Devices are spread over a few threads, each waiting on its own epoll set. A
+ * thread moves the devices its set reported onto its ready queue, threads with
+ * nothing to do steal from the queues of the others. Devices are watched one
+ * shot, so a device is only ever queued once and handled by one thread at a
+ * time until it's rearmed, which keeps its events in order */
+class io_engine_sharded : public io_engine {
+    /* Reads go through a duplicate of the descriptor, so a thread still reading
+     * after the device was detached and closed never reads another node. Input
+     * a thread read before its device was suspended is still dispatched */
+    struct slot {
+        device_node* dev; /* Only used by the hook thread, io threads go through owner */
+        std::weak_ptr<device_node> owner;
+        uint64_t id;
+        int fd;
+        int epoll_fd;
+        std::atomic<bool> detached { false };
+        std::atomic<bool> closed { false };
+
+        ~slot() { close(fd); }
+    };
+
+    struct shard {
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        std::mutex mutex; /* Guards slots and ready */
+        std::unordered_map<uint64_t, std::shared_ptr<slot>> slots;
+        std::deque<std::shared_ptr<slot>> ready;
+        std::atomic<bool> idle { false };
+        size_t devices = 0; /* Guarded by the engine mutex */
+        std::thread thread;
+    };
+
+    io_dispatch m_dispatch;
+    std::vector<std::unique_ptr<shard>> m_shards;
+    std::unordered_map<uint64_t, size_t> m_owner; /* Slot id -> shard, guarded by m_mutex */
+    uint64_t m_next_id = 0;
+    std::atomic<bool> m_stop { false };
+
+    static void arm(const slot& s, int op)
+    {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = s.id;
+        epoll_ctl(s.epoll_fd, op, s.fd, &ev);
+    }
+
+    /* Next device from the own queue, or the oldest one of another thread */
+    std::shared_ptr<slot> take(size_t index)
+    {
+        for (size_t i = 0; i < m_shards.size(); i++) {
+            auto& sh = *m_shards[(index + i) % m_shards.size()];
+            std::lock_guard<std::mutex> lock(sh.mutex);
+            if (!sh.ready.empty()) {
+                auto s = std::move(sh.ready.front());
+                sh.ready.pop_front();
+                return s;
+            }
+        }
+        return nullptr;
+    }
+
+    void process(const std::shared_ptr<slot>& s, uint8_t* buffer)
+    {
+        if (s->detached)
+            return;
+
+        const auto len = read(s->fd, buffer, IO_READ_SIZE);
+        if (len > 0) {
+            m_dispatch(s->owner, s->closed, buffer, len);
+            arm(*s, EPOLL_CTL_MOD);
+        } else if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+            arm(*s, EPOLL_CTL_MOD);
+        } else {
+            /* Stays disarmed, the device is detached once it's closed */
+            m_dispatch(s->owner, s->closed, nullptr, len < 0 ? -errno : -EIO);
+        }
+    }
+
+    void run(size_t index)
+    {
+        auto& sh = *m_shards[index];
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[IO_READ_SIZE]);
+        std::vector<struct epoll_event> events(64);
+
+        while (!m_stop) {
+            if (auto s = take(index)) {
+                process(s, buffer.get());
+                continue;
+            }
+
+            sh.idle = true;
+            const auto count = epoll_wait(sh.epoll_fd, events.data(), int(events.size()), -1);
+            sh.idle = false;
+
+            size_t backlog = 0;
+            {
+                std::lock_guard<std::mutex> lock(sh.mutex);
+                for (int i = 0; i < count; i++) {
+                    if (events[i].data.u64 == uint64_t(-1)) {
+                        eventfd_t value;
+                        eventfd_read(sh.wake_fd, &value);
+                        continue;
+                    }
+                    /* Ids aren't reused, events of detached slots find nothing */
+                    auto it = sh.slots.find(events[i].data.u64);
+                    if (it != sh.slots.end())
+                        sh.ready.emplace_back(it->second);
+                }
+                backlog = sh.ready.size();
+            }
+
+            /* This thread handles one device, idle ones are woken to steal the rest */
+            for (size_t i = 1; i < m_shards.size() && backlog > 1; i++) {
+                auto& other = *m_shards[(index + i) % m_shards.size()];
+                if (other.idle) {
+                    eventfd_write(other.wake_fd, 1);
+                    backlog--;
+                }
+            }
+        }
+    }
+
+public:
+    io_engine_sharded(io_dispatch dispatch, unsigned threads)
+        : m_dispatch(std::move(dispatch))
+    {
+        for (unsigned i = 0; i < threads; i++) {
+            std::unique_ptr<shard> sh(new shard());
+            sh->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            sh->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.u64 = uint64_t(-1);
+            if (sh->epoll_fd < 0 || sh->wake_fd < 0 || epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, sh->wake_fd, &ev) < 0) {
+                gerr("Couldn't create io thread: %s", strerror(errno));
+                if (sh->epoll_fd >= 0)
+                    close(sh->epoll_fd);
+                if (sh->wake_fd >= 0)
+                    close(sh->wake_fd);
+                break;
+            }
+            m_shards.emplace_back(std::move(sh));
+        }
+
+        for (size_t i = 0; i < m_shards.size(); i++)
+            m_shards[i]->thread = std::thread(&io_engine_sharded::run, this, i);
+    }
+
+    ~io_engine_sharded()
+    {
+        m_stop = true;
+        for (auto& sh : m_shards) {
+            eventfd_write(sh->wake_fd, 1);
+            sh->thread.join();
+        }
+
+        for (auto& sh : m_shards) {
+            for (auto& s : sh->slots)
+                s.second->dev->set_io(nullptr, -1, io_mode::SELF);
+            sh->slots.clear();
+            sh->ready.clear();
+            close(sh->epoll_fd);
+            close(sh->wake_fd);
+        }
+    }
+
+    bool valid() const { return !m_shards.empty(); }
+
+    io_engine_type::type type() const override { return io_engine_type::SHARDED; }
+
+    bool attach(device_node* dev) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t index = 0;
+        for (size_t i = 1; i < m_shards.size(); i++) {
+            if (m_shards[i]->devices < m_shards[index]->devices)
+                index = i;
+        }
+        auto& sh = *m_shards[index];
+
+        auto s = std::make_shared<slot>();
+        s->dev = dev;
+        s->owner = dev->shared_from_this();
+        s->id = m_next_id++;
+        s->epoll_fd = sh.epoll_fd;
+        s->fd = fcntl(dev->get_fd(), F_DUPFD_CLOEXEC, 0);
+        if (s->fd < 0) {
+            gwarn("Couldn't attach '%s' to an io thread: %s", dev->get_path().c_str(), strerror(errno));
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> shard_lock(sh.mutex);
+            sh.slots[s->id] = s;
+        }
+        m_owner[s->id] = index;
+        sh.devices++;
+        dev->set_io(this, int(s->id), io_mode::FED);
+        arm(*s, EPOLL_CTL_ADD);
+        return true;
+    }
+
+    void detach(device_node* dev) override { remove(dev, false); }
+    void suspend(device_node* dev) override { remove(dev, true); }
+
+    void remove(device_node* dev, bool keep_input)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto id = uint64_t(dev->get_io_slot());
+        auto owner = m_owner.find(id);
+        auto& sh = *m_shards[owner->second];
+        m_owner.erase(owner);
+        sh.devices--;
+        dev->set_io(nullptr, -1, io_mode::SELF);
+
+        /* A thread that's handling it right now keeps the slot alive until it's done */
+        std::lock_guard<std::mutex> shard_lock(sh.mutex);
+        auto it = sh.slots.find(id);
+        it->second->detached = true;
+        it->second->closed = !keep_input;
+        epoll_ctl(sh.epoll_fd, EPOLL_CTL_DEL, it->second->fd, nullptr);
+        sh.slots.erase(it);
+    }
+
+    bool wait(std::chrono::nanoseconds timeout) override
+    {
+        /* Input never goes through the hook thread */
+        std::this_thread::sleep_for(timeout);
+        return false;
+    }
+};
+
+std::unique_ptr<io_engine> io_engine::make(io_engine_type::type type, io_dispatch dispatch, unsigned threads)
+{
+    if (type == io_engine_type::SHARDED) {
+        std::unique_ptr<io_engine_sharded> sharded(
+            new io_engine_sharded(std::move(dispatch), threads ? threads : std::max(1u, std::thread::hardware_concurrency())));
+        if (sharded->valid())
+            return std::unique_ptr<io_engine>(sharded.release());
+        return nullptr;
+    }
+
+    if (type == io_engine_type::THREAD_PER_DEVICE)
+        return std::unique_ptr<io_engine>(new io_engine_threads(std::move(dispatch)));
+
+    if (type == io_engine_type::IO_URING || type == io_engine_type::AUTO) {
+        std::unique_ptr<io_engine_uring> uring(new io_engine_uring());
+        if (uring->valid())
+            return std::unique_ptr<io_engine>(uring.release());
+        if (type == io_engine_type::IO_URING)
+            return nullptr;
+    }
+
+    if (type == io_engine_type::EPOLL || type == io_engine_type::AUTO) {
+        std::unique_ptr<io_engine_epoll> epoll(new io_engine_epoll());
+        if (epoll->valid())
+            return std::unique_ptr<io_engine>(epoll.release());
+        gerr("Couldn't create epoll instance: %s", strerror(errno));
+    }
+    return nullptr;
+}
+}
@@ -0,0 +1,74 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <gamepad/hook-linux.hpp>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+
+namespace gamepad {
+class device_node;
+
+/* Called by engines that read on their own threads once a device has input. data
+ * is what the engine read, nullptr if the device is only readable and reads itself,
+ * a negative len is an errno. Devices that are gone by then are skipped, nothing
+ * happens if detached is set by the time the device's input mutex is held. It stays
+ * unset for input read before the device was suspended */
+using io_dispatch = std::function<void(
+    const std::weak_ptr<device_node>& dev, const std::atomic<bool>& detached, const void* data, ssize_t len)>;
+
+/* Waits for input on the descriptors of open devices, so the hook thread
+ * doesn't have to try a read() on every device on every iteration.
+ * attach() and wait() are only called by the hook thread, detach() can be
+ * called from any thread, it's called whenever a device closes its node.
+ * attach() and suspend() are called with the device's input mutex held */
+class io_engine {
+protected:
+    std::mutex m_mutex;
+
+public:
+    virtual ~io_engine() { }
+
+    virtual io_engine_type::type type() const = 0;
+
+    /* Starts watching the open descriptor of dev */
+    virtual bool attach(device_node* dev) = 0;
+    virtual void detach(device_node* dev) = 0;
+    /* Detaches a device that's paused or disabled rather than closed, input the
+     * engine already read is still handed to it */
+    virtual void suspend(device_node* dev) { detach(dev); }
+
+    /* Blocks until one of the devices has input or the timeout passed,
+     * returns true if the engine saw input */
+    virtual bool wait(std::chrono::nanoseconds timeout) = 0;
+
+    /* Readable while wait() would return right away, -1 for engines that
+     * dispatch on their own threads */
+    virtual int get_fd() const { return -1; }
+
+    /* Creates the requested engine, AUTO tries io_uring first and falls back
+     * to epoll. nullptr for READ or if the engine isn't available. dispatch
+     * and threads are only used by engines with their own threads */
+    static std::unique_ptr<io_engine> make(io_engine_type::type type, io_dispatch dispatch, unsigned threads);
+};
+}
@@ -0,0 +1,83 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace gamepad {
+
+/* Lock free queue with any number of producers and a single consumer.
+ * Producers push onto a list, the consumer takes the whole list in one
+ * exchange and reverses it, so there's no ABA problem and items come out
+ * in the order they were pushed */
+template <class T>
+class mpsc_queue {
+    struct node {
+        T value;
+        node* next;
+    };
+
+    std::atomic<node*> m_head { nullptr };
+
+public:
+    mpsc_queue() = default;
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    ~mpsc_queue()
+    {
+        consume([](T&) {});
+    }
+
+    void push(T value)
+    {
+        auto* n = new node { std::move(value), m_head.load(std::memory_order_relaxed) };
+        while (!m_head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    bool empty() const { return m_head.load(std::memory_order_acquire) == nullptr; }
+
+    /* Calls f for every queued item, oldest first, returns the number of items */
+    template <class F>
+    size_t consume(F f)
+    {
+        node* n = m_head.exchange(nullptr, std::memory_order_acquire);
+        node* reversed = nullptr;
+        while (n) {
+            auto* next = n->next;
+            n->next = reversed;
+            reversed = n;
+            n = next;
+        }
+
+        size_t count = 0;
+        while (reversed) {
+            auto* next = reversed->next;
+            f(reversed->value);
+            delete reversed;
+            reversed = next;
+            count++;
+        }
+        return count;
+    }
+};
+}
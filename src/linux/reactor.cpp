@@ -0,0 +1,382 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "reactor.hpp"
+#include "device-node.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <gamepad/log.hpp>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace gamepad {
+
+/* Bytes read per node and read, a full evdev batch or 192 js events */
+static const size_t REACTOR_READ_SIZE = 64 * sizeof(struct ::input_event);
+
+bool read_folder(const char* folder, std::vector<folder_entry>& entries)
+{
+    DIR* dir = opendir(folder);
+    if (!dir)
+        return false;
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        /* Nodes are character devices and by-id entries are links to them,
+         * only file systems that don't fill in d_type need a stat */
+        auto type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat entry_st;
+            if (fstatat(dirfd(dir), ent->d_name, &entry_st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            type = S_ISCHR(entry_st.st_mode) ? DT_CHR : S_ISLNK(entry_st.st_mode) ? DT_LNK : DT_REG;
+        }
+        if (type == DT_CHR || type == DT_LNK)
+            entries.push_back({ ent->d_name, ent->d_ino });
+    }
+    closedir(dir);
+    return true;
+}
+
+/* Hands the devices of one hook to the reactor, input never goes through the hook thread */
+class io_engine_reactor : public io_engine {
+    std::shared_ptr<reactor> m_reactor;
+    io_dispatch m_dispatch;
+
+public:
+    io_engine_reactor(std::shared_ptr<reactor> r, io_dispatch dispatch)
+        : m_reactor(std::move(r))
+        , m_dispatch(std::move(dispatch))
+    {
+    }
+
+    io_engine_type::type type() const override { return io_engine_type::SHARED; }
+    bool attach(device_node* dev) override { return m_reactor->attach(dev, this, m_dispatch); }
+    void detach(device_node* dev) override { m_reactor->detach(dev); }
+    bool wait(std::chrono::nanoseconds timeout) override
+    {
+        std::this_thread::sleep_for(timeout);
+        return false;
+    }
+};
+
+reactor::reactor()
+{
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wake_fd;
+    if (m_epoll_fd < 0 || m_wake_fd < 0 || epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) < 0) {
+        gerr("Couldn't set up the shared reactor: %s", strerror(errno));
+        return;
+    }
+    m_input_thread = std::thread(&reactor::input_thread, this);
+    m_discovery_thread = std::thread(&reactor::discovery_thread, this);
+}
+
+reactor::~reactor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_stop = true;
+    }
+    m_discovery_cv.notify_all();
+    if (m_discovery_thread.joinable())
+        m_discovery_thread.join();
+
+    if (m_input_thread.joinable()) {
+        eventfd_write(m_wake_fd, 1);
+        m_input_thread.join();
+    }
+
+    for (auto& n : m_nodes) {
+        gwarn("Shared node '%s' is still open", n.second.path.c_str());
+        close(n.first);
+    }
+    if (m_epoll_fd >= 0)
+        close(m_epoll_fd);
+    if (m_wake_fd >= 0)
+        close(m_wake_fd);
+}
+
+std::shared_ptr<reactor> reactor::get()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<reactor> instance;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto r = instance.lock();
+    if (!r) {
+        r = std::make_shared<reactor>();
+        instance = r;
+    }
+    return r;
+}
+
+static std::pair<uint64_t, uint64_t> identify(const struct stat& st)
+{
+    if (S_ISCHR(st.st_mode))
+        return { uint64_t(st.st_rdev), 0 };
+    return { uint64_t(st.st_dev), uint64_t(st.st_ino) };
+}
+
+int reactor::open_node(const std::string& path, bool js)
+{
+    /* Links like the by-id ones are followed, so they end up at the same node */
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto live = m_live.find(identify(st));
+    if (live != m_live.end()) {
+        auto& n = m_nodes[live->second];
+        if (n.watched) {
+            n.refs++;
+            return n.fd;
+        }
+        /* It failed since, e.g. the device was unplugged and came back with the
+         * same number. Devices still holding it keep it until they close it */
+        m_live.erase(live);
+    }
+
+    const int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    auto& n = m_nodes[fd];
+    n.fd = fd;
+    n.refs = 1;
+    n.js = js;
+    n.id = identify(st);
+    n.path = path;
+    m_live[n.id] = fd;
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    n.watched = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    if (!n.watched)
+        gwarn("Couldn't watch shared node '%s': %s", path.c_str(), strerror(errno));
+    return fd;
+}
+
+void reactor::close_node(int fd)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_nodes.find(fd);
+    if (it == m_nodes.end())
+        return;
+
+    auto& n = it->second;
+    if (--n.refs > 0)
+        return;
+
+    if (n.watched)
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    if (close(fd) == -1)
+        gerr("Couldn't close shared node '%s'", n.path.c_str());
+    auto live = m_live.find(n.id);
+    if (live != m_live.end() && live->second == fd)
+        m_live.erase(live);
+    m_nodes.erase(it);
+}
+
+std::unique_ptr<io_engine> reactor::make_engine(io_dispatch dispatch)
+{
+    return std::unique_ptr<io_engine>(new io_engine_reactor(shared_from_this(), std::move(dispatch)));
+}
+
+bool reactor::attach(device_node* dev, io_engine* engine, io_dispatch dispatch)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_nodes.find(dev->get_fd());
+    if (it == m_nodes.end())
+        return false;
+
+    auto& n = it->second;
+    auto sub = std::make_shared<subscriber>();
+    sub->dev = dev;
+    sub->owner = dev->shared_from_this();
+    sub->dispatch = std::move(dispatch);
+    n.subscribers.emplace_back(sub);
+    dev->set_io(engine, 0, io_mode::FED);
+
+    /* The caller holds the input mutex of the device, so it can be fed directly */
+    if (n.js && !n.js_state.empty()) {
+        std::vector<struct js_event> startup;
+        for (const auto& s : n.js_state) {
+            struct js_event e = {};
+            e.type = uint8_t(s.first >> 8) | JS_EVENT_INIT;
+            e.number = uint8_t(s.first);
+            e.value = s.second;
+            startup.emplace_back(e);
+        }
+        dev->feed(startup.data(), startup.size() * sizeof(struct js_event));
+    }
+    return true;
+}
+
+void reactor::detach(device_node* dev)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    dev->set_io(nullptr, -1, io_mode::SELF);
+    auto node = m_nodes.find(dev->get_fd());
+    if (node == m_nodes.end())
+        return;
+
+    auto& subs = node->second.subscribers;
+    for (auto it = subs.begin(); it != subs.end(); ++it) {
+        if ((*it)->dev == dev) {
+            (*it)->detached = true;
+            subs.erase(it);
+            break;
+        }
+    }
+}
+
+void reactor::input_thread()
+{
+    std::vector<struct epoll_event> events(64);
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[REACTOR_READ_SIZE]);
+    std::vector<std::shared_ptr<subscriber>> subs;
+
+    for (;;) {
+        const auto count = epoll_wait(m_epoll_fd, events.data(), int(events.size()), -1);
+        if (count < 0 && errno != EINTR) {
+            gerr("Shared reactor failed: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < count; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == m_wake_fd)
+                return;
+
+            /* Read under the lock, so a device that's attaching either gets
+             * this input through the js state or as a subscriber */
+            ssize_t len;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto node = m_nodes.find(fd);
+                if (node == m_nodes.end())
+                    continue;
+                auto& n = node->second;
+
+                len = read(fd, buffer.get(), REACTOR_READ_SIZE);
+                if (len < 0 && (errno == EAGAIN || errno == EINTR))
+                    continue;
+                if (len <= 0) {
+                    /* Gone, every device gets the error, the node closes with the last one */
+                    len = len < 0 ? -errno : -EIO;
+                    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                    n.watched = false;
+                } else if (n.js) {
+                    const auto* e = reinterpret_cast<const struct js_event*>(buffer.get());
+                    for (size_t j = 0; j < size_t(len) / sizeof(struct js_event); j++)
+                        n.js_state[uint16_t((e[j].type & ~JS_EVENT_INIT) << 8 | e[j].number)] = e[j].value;
+                }
+                subs = n.subscribers;
+            }
+
+            for (const auto& s : subs)
+                s->dispatch(s->owner, s->detached, len < 0 ? nullptr : buffer.get(), len);
+            subs.clear();
+        }
+    }
+}
+
+void reactor::wake_discovery()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_discovery_wake = true;
+    }
+    m_discovery_cv.notify_all();
+}
+
+void reactor::add_discovery(const void* owner, std::function<void()> probe, std::chrono::nanoseconds interval)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_discovery_mutex);
+        m_discoveries.push_back({ owner, std::move(probe), interval, std::chrono::steady_clock::now() });
+    }
+    wake_discovery();
+}
+
+void reactor::remove_discovery(const void* owner)
+{
+    std::lock_guard<std::mutex> lock(m_discovery_mutex);
+    m_discoveries.erase(std::remove_if(m_discoveries.begin(), m_discoveries.end(),
+                            [owner](const discovery& d) { return d.owner == owner; }),
+        m_discoveries.end());
+}
+
+bool reactor::list_folder(const char* folder, const struct stat& st, std::vector<folder_entry>& entries)
+{
+    std::lock_guard<std::mutex> lock(m_listing_mutex);
+    auto& l = m_listings[folder];
+    if (l.entries.empty() || l.st.st_dev != st.st_dev || l.st.st_ino != st.st_ino
+        || l.st.st_mtim.tv_sec != st.st_mtim.tv_sec || l.st.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+        l.entries.clear();
+        if (!read_folder(folder, l.entries))
+            return false;
+        l.st = st;
+    }
+    entries = l.entries;
+    return true;
+}
+
+void reactor::discovery_thread()
+{
+    for (;;) {
+        auto next = std::chrono::steady_clock::time_point::max();
+        {
+            std::lock_guard<std::mutex> lock(m_discovery_mutex);
+            const auto now = std::chrono::steady_clock::now();
+            for (auto& d : m_discoveries) {
+                if (d.due <= now) {
+                    d.probe();
+                    d.due = now + d.interval;
+                }
+                next = std::min(next, d.due);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(m_wake_mutex);
+        auto woken = [this] { return m_stop || m_discovery_wake; };
+        if (next == std::chrono::steady_clock::time_point::max())
+            m_discovery_cv.wait(lock, woken);
+        else
+            m_discovery_cv.wait_until(lock, next, woken);
+        if (m_stop)
+            return;
+        m_discovery_wake = false;
+    }
+}
+}
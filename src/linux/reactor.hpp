@@ -0,0 +1,137 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "io-engine.hpp"
+#include <condition_variable>
+#include <linux/joystick.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace gamepad {
+
+/* An entry of a device folder that could be a node or a link to one */
+struct folder_entry {
+    std::string name;
+    uint64_t ino;
+};
+
+/* Lists the character devices and links in a folder */
+bool read_folder(const char* folder, std::vector<folder_entry>& entries);
+
+/* Process wide owner of the nodes of all hooks created with hook_type::SHARED.
+ * Every node is opened once and its descriptor is shared by the devices of all
+ * hooks, the reactor thread reads it and feeds the input to each of them. The
+ * probe passes of all hooks run on one discovery thread and share the folder
+ * listing, so a folder is only read once per change */
+class reactor : public std::enable_shared_from_this<reactor> {
+    struct subscriber {
+        device_node* dev; /* Only compared, the input thread goes through owner */
+        std::weak_ptr<device_node> owner;
+        io_dispatch dispatch;
+        std::atomic<bool> detached { false };
+    };
+
+    /* Identity of a node, the device number for character devices, so every
+     * path leading to a device shares one descriptor. Device and inode otherwise */
+    typedef std::pair<uint64_t, uint64_t> node_id;
+
+    struct shared_node {
+        int fd = -1;
+        int refs = 0;
+        bool watched = false; /* False once the node failed, it's reopened for new users */
+        bool js = false; /* A joydev node, its js state is replayed to late devices */
+        node_id id;
+        std::string path; /* The first path it was opened through, for messages */
+        std::vector<std::shared_ptr<subscriber>> subscribers;
+        /* Last value of each js axis and button, replayed as the startup state
+         * for devices that attach after joydev sent it. Keyed by type and number */
+        std::unordered_map<uint16_t, int16_t> js_state;
+    };
+
+    struct discovery {
+        const void* owner;
+        std::function<void()> probe;
+        std::chrono::nanoseconds interval;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    struct listing {
+        struct stat st;
+        std::vector<folder_entry> entries;
+    };
+
+    std::mutex m_mutex; /* Guards the nodes */
+    std::unordered_map<int, shared_node> m_nodes; /* By descriptor */
+    std::map<node_id, int> m_live; /* Descriptor of the node that new users get */
+    int m_epoll_fd = -1;
+    int m_wake_fd = -1;
+    std::thread m_input_thread;
+
+    std::mutex m_discovery_mutex; /* Guards the discoveries, held while probing */
+    std::mutex m_listing_mutex;
+    std::mutex m_wake_mutex;
+    std::condition_variable m_discovery_cv;
+    bool m_discovery_wake = false;
+    bool m_stop = false;
+    std::vector<discovery> m_discoveries;
+    std::unordered_map<std::string, listing> m_listings;
+    std::thread m_discovery_thread;
+
+    void input_thread();
+    void discovery_thread();
+    void wake_discovery();
+
+public:
+    reactor();
+    ~reactor();
+
+    /* The instance shared by all hooks, it's created when the first hook needs it
+     * and goes away with the last device or hook holding on to it */
+    static std::shared_ptr<reactor> get();
+
+    /* Reference counted descriptor of a node, opened on the first call per device.
+     * js is set for joydev nodes */
+    int open_node(const std::string& path, bool js);
+    void close_node(int fd);
+
+    /* Engine for a hook, input of its devices is passed to dispatch */
+    std::unique_ptr<io_engine> make_engine(io_dispatch dispatch);
+
+    /* Feeds the input read from the node of dev to it from now on,
+     * starting with the js state that was read so far */
+    bool attach(device_node* dev, io_engine* engine, io_dispatch dispatch);
+    void detach(device_node* dev);
+
+    /* probe is called on the discovery thread right away and then every interval,
+     * remove_discovery() waits for a probe pass of owner that's running */
+    void add_discovery(const void* owner, std::function<void()> probe, std::chrono::nanoseconds interval);
+    void remove_discovery(const void* owner);
+
+    /* read_folder() for probe passes, the listing is reused while st matches the
+     * one it was made for, so hooks scanning the same folder only read it once */
+    bool list_folder(const char* folder, const struct stat& st, std::vector<folder_entry>& entries);
+};
+}
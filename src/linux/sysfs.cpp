@@ -0,0 +1,116 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "sysfs.hpp"
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <unistd.h>
+#include <vector>
+
+namespace gamepad {
+namespace sysfs {
+
+    /* Attributes are a single short line, so a plain read is enough */
+    static bool read_attribute(const std::string& path, std::string& out)
+    {
+        char buf[256];
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        auto len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len < 0)
+            return false;
+
+        while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+            len--;
+        out.assign(buf, size_t(len));
+        return true;
+    }
+
+    static uint16_t read_hex_attribute(const std::string& path)
+    {
+        std::string value;
+        if (!read_attribute(path, value))
+            return 0;
+        return uint16_t(strtoul(value.c_str(), nullptr, 16));
+    }
+
+    /* capabilities/key is a list of hex words, most significant first */
+    static bool has_gamepad_buttons(const std::string& path)
+    {
+        std::string value;
+        if (!read_attribute(path, value))
+            return false;
+
+        std::vector<unsigned long> words;
+        const char* p = value.c_str();
+        char* end;
+        for (;;) {
+            auto word = strtoul(p, &end, 16);
+            if (end == p)
+                break;
+            words.emplace_back(word);
+            p = end;
+        }
+
+        const size_t bits = sizeof(unsigned long) * CHAR_BIT;
+        auto test = [&](size_t code) {
+            const size_t word = code / bits;
+            return word < words.size() && (words[words.size() - 1 - word] >> (code % bits)) & 1;
+        };
+        return test(BTN_GAMEPAD) || test(BTN_JOYSTICK);
+    }
+
+    std::string identity::key() const
+    {
+        char ids[24];
+        snprintf(ids, sizeof(ids), "%04x:%04x:%04x:%04x:", bustype, vendor, product, version);
+        const auto kind = node.substr(0, node.find_first_of("0123456789"));
+        return ids + kind + ":" + name + ":" + (!uniq.empty() ? uniq : phys);
+    }
+
+    bool read_identity(const std::string& dev_path, identity& id)
+    {
+        char resolved[PATH_MAX];
+        if (!realpath(dev_path.c_str(), resolved))
+            return false;
+
+        std::string node = resolved;
+        node = node.substr(node.rfind('/') + 1);
+        const auto base = "/sys/class/input/" + node + "/device/";
+
+        if (!read_attribute(base + "name", id.name))
+            return false;
+
+        id.node = node;
+        read_attribute(base + "phys", id.phys);
+        read_attribute(base + "uniq", id.uniq);
+        id.bustype = read_hex_attribute(base + "id/bustype");
+        id.vendor = read_hex_attribute(base + "id/vendor");
+        id.product = read_hex_attribute(base + "id/product");
+        id.version = read_hex_attribute(base + "id/version");
+        id.is_gamepad = has_gamepad_buttons(base + "capabilities/key");
+        return true;
+    }
+}
+}
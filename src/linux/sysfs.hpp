@@ -0,0 +1,51 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace gamepad {
+namespace sysfs {
+
+    /* Identity of an input node as described by /sys/class/input/<node>/device,
+     * which can be read without opening the node itself */
+    struct identity {
+        std::string node; /* e.g. js0 or event3 */
+        std::string name;
+        std::string phys; /* Physical path, stable as long as the port doesn't change */
+        std::string uniq; /* Serial number, if the device has one */
+        uint16_t bustype = 0;
+        uint16_t vendor = 0;
+        uint16_t product = 0;
+        uint16_t version = 0;
+        bool is_gamepad = false; /* Reports gamepad or joystick buttons */
+
+        /* Key that stays the same when the device comes back under another
+         * node, unless it has no serial and is plugged into another port. It
+         * includes the kind of node and the name, since the input devices of
+         * one HID device, e.g. a pad and its motion sensors, share the serial */
+        std::string key() const;
+    };
+
+    /* Fills id for a device node path, symlinks like the by-id links are resolved.
+     * Returns false if sysfs has no entry for the node */
+    bool read_identity(const std::string& dev_path, identity& id);
+}
+}
@@ -0,0 +1,262 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "warm-state.hpp"
+#include <cstring>
+#include <fstream>
+#include <gamepad/log.hpp>
+#include <iterator>
+
+namespace gamepad {
+namespace warm_state {
+
+    static const char magic[4] = { 'L', 'G', 'P', 'W' };
+    static const uint16_t version = 2; /* 2: cache ids include the node kind and name */
+
+    class writer {
+        std::vector<char> m_data;
+
+    public:
+        template <class T>
+        void put(const T& value)
+        {
+            const auto* p = reinterpret_cast<const char*>(&value);
+            m_data.insert(m_data.end(), p, p + sizeof(T));
+        }
+
+        void put(const std::string& str)
+        {
+            put(uint32_t(str.size()));
+            m_data.insert(m_data.end(), str.begin(), str.end());
+        }
+
+        template <class T>
+        void put(const std::vector<T>& values)
+        {
+            put(uint32_t(values.size()));
+            for (const auto& v : values)
+                put(v);
+        }
+
+        void put(const cfg::mappings& m)
+        {
+            put(uint32_t(m.size()));
+            for (const auto& e : m) {
+                put(e.first);
+                put(e.second);
+            }
+        }
+
+        const std::vector<char>& data() const { return m_data; }
+    };
+
+    /* Every read is bounds checked, a truncated file fails instead of reading garbage */
+    class reader {
+        const std::vector<char>& m_data;
+        size_t m_pos = 0;
+        bool m_ok = true;
+
+        bool take(void* out, size_t size)
+        {
+            if (!m_ok || m_data.size() - m_pos < size)
+                return m_ok = false;
+            memcpy(out, m_data.data() + m_pos, size);
+            m_pos += size;
+            return true;
+        }
+
+    public:
+        reader(const std::vector<char>& data)
+            : m_data(data)
+        {
+        }
+
+        bool ok() const { return m_ok; }
+        bool done() const { return m_ok && m_pos == m_data.size(); }
+
+        template <class T>
+        void get(T& value)
+        {
+            if (!take(&value, sizeof(T)))
+                value = T();
+        }
+
+        void get(std::string& str)
+        {
+            uint32_t size = 0;
+            get(size);
+            if (!m_ok || m_data.size() - m_pos < size) {
+                m_ok = false;
+                return;
+            }
+            str.assign(m_data.data() + m_pos, size);
+            m_pos += size;
+        }
+
+        template <class T>
+        void get(std::vector<T>& values)
+        {
+            uint32_t size = 0;
+            get(size);
+            if (!m_ok || (m_data.size() - m_pos) / sizeof(T) < size) {
+                m_ok = false;
+                return;
+            }
+            values.resize(size);
+            for (auto& v : values)
+                get(v);
+        }
+
+        void get(cfg::mappings& m)
+        {
+            uint32_t size = 0;
+            get(size);
+            for (uint32_t i = 0; i < size && m_ok; i++) {
+                uint16_t native = 0, vc = 0;
+                get(native);
+                get(vc);
+                m[native] = vc;
+            }
+        }
+    };
+
+    bool save(const std::string& path, const state& s)
+    {
+        writer w;
+        for (const auto c : magic)
+            w.put(c);
+        w.put(version);
+        w.put(s.flags);
+
+        w.put(uint32_t(s.bindings.size()));
+        for (const auto& b : s.bindings) {
+            w.put(uint8_t(b.custom));
+            w.put(b.name);
+            w.put(b.buttons);
+            w.put(b.axis);
+        }
+
+        w.put(uint32_t(s.binding_map.size()));
+        for (const auto& m : s.binding_map) {
+            w.put(m.first);
+            w.put(m.second);
+        }
+
+        w.put(uint32_t(s.devices.size()));
+        for (const auto& d : s.devices) {
+            w.put(d.cache_id);
+            w.put(d.path);
+            w.put(d.name);
+            w.put(d.binding);
+            w.put(d.axes);
+            w.put(d.buttons);
+            w.put(d.axis_codes);
+            w.put(d.button_codes);
+            w.put(d.key_codes);
+            w.put(uint32_t(d.abs.size()));
+            for (const auto& a : d.abs) {
+                w.put(a.first);
+                w.put(a.second);
+            }
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(w.data().data(), std::streamsize(w.data().size()));
+        if (!out.good()) {
+            gerr("Can't write warm state to '%s'", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool load(const std::string& path, state& s)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.good())
+            return false;
+        const std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        reader r(data);
+        char file_magic[4] = {};
+        uint16_t file_version = 0;
+        for (auto& c : file_magic)
+            r.get(c);
+        r.get(file_version);
+        if (!r.ok() || memcmp(file_magic, magic, sizeof(magic)) != 0 || file_version != version) {
+            gwarn("'%s' isn't a warm state file of this version", path.c_str());
+            return false;
+        }
+        r.get(s.flags);
+
+        uint32_t count = 0;
+        r.get(count);
+        for (uint32_t i = 0; i < count && r.ok(); i++) {
+            binding_entry b;
+            uint8_t custom = 0;
+            r.get(custom);
+            b.custom = custom != 0;
+            r.get(b.name);
+            r.get(b.buttons);
+            r.get(b.axis);
+            s.bindings.emplace_back(std::move(b));
+        }
+
+        r.get(count);
+        for (uint32_t i = 0; i < count && r.ok(); i++) {
+            std::pair<std::string, std::string> m;
+            r.get(m.first);
+            r.get(m.second);
+            s.binding_map.emplace_back(std::move(m));
+        }
+
+        r.get(count);
+        for (uint32_t i = 0; i < count && r.ok(); i++) {
+            device_entry d;
+            r.get(d.cache_id);
+            r.get(d.path);
+            r.get(d.name);
+            r.get(d.binding);
+            r.get(d.axes);
+            r.get(d.buttons);
+            r.get(d.axis_codes);
+            r.get(d.button_codes);
+            r.get(d.key_codes);
+
+            uint32_t abs_count = 0;
+            r.get(abs_count);
+            for (uint32_t j = 0; j < abs_count && r.ok(); j++) {
+                std::pair<uint16_t, struct input_absinfo> a;
+                r.get(a.first);
+                r.get(a.second);
+                d.abs.emplace_back(a);
+            }
+            if (d.binding != UINT32_MAX && d.binding >= s.bindings.size()) {
+                gwarn("'%s' references a binding that doesn't exist", path.c_str());
+                return false;
+            }
+            s.devices.emplace_back(std::move(d));
+        }
+
+        if (!r.done()) {
+            gwarn("'%s' is truncated or corrupt", path.c_str());
+            return false;
+        }
+        return true;
+    }
+}
+}
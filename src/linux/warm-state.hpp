@@ -0,0 +1,68 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <gamepad/binding.hpp>
+#include <linux/input.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gamepad {
+namespace warm_state {
+
+    /* Compiled mappings of a binding. Custom ones are added to the hook's
+     * bindings, the others are the kernel or default bindings of a device */
+    struct binding_entry {
+        std::string name;
+        bool custom = false;
+        cfg::mappings buttons;
+        cfg::mappings axis;
+    };
+
+    struct device_entry {
+        std::string cache_id; /* sysfs identity key, checked before the entry is used */
+        std::string path;
+        std::string name;
+        uint32_t binding = UINT32_MAX; /* Index into state::bindings */
+
+        /* joydev capabilities */
+        uint8_t axes = 0, buttons = 0;
+        std::vector<uint8_t> axis_codes;
+        std::vector<uint16_t> button_codes;
+
+        /* evdev capabilities */
+        std::vector<uint16_t> key_codes;
+        std::vector<std::pair<uint16_t, struct input_absinfo>> abs;
+    };
+
+    struct state {
+        uint16_t flags = 0; /* hook_type the state was saved with */
+        std::vector<binding_entry> bindings;
+        std::vector<std::pair<std::string, std::string>> binding_map;
+        std::vector<device_entry> devices;
+    };
+
+    /* The file is a cache for this machine, it's written in native byte order
+     * and rejected as a whole if the magic, version or size doesn't match */
+    bool save(const std::string& path, const state& s);
+    bool load(const std::string& path, state& s);
+}
+}
@@ -54,25 +54,26 @@ namespace cfg {
          * we reimplement the entire save process */
         bool result = false;
         if (j.is_object()) {
-            m_binding_name = j["name"].string_value();
-            auto arr = j["binds"];
+            set_name(j["name"].string_value());
+            const auto& arr = j["binds"];
 
             if (arr.is_array()) {
-                m_axis_mappings.clear();
-                m_buttons_mappings.clear();
+                mapping_table table;
 
                 for (const auto& val : arr.array_items()) {
+                    const auto from = val["from"].int_value(), to = val["to"].int_value();
                     if (val["is_axis"].bool_value()) {
-                        m_axis_mappings[val["from"].int_value()] = val["to"].int_value();
-                        if (val["to"] == axis::LEFT_TRIGGER) {
+                        table.axis[from] = to;
+                        if (to == axis::LEFT_TRIGGER) {
                             m_left_trigger_polarity = val["trigger_polarity"].int_value();
-                        } else if (val["to"] == axis::RIGHT_TRIGGER) {
+                        } else if (to == axis::RIGHT_TRIGGER) {
                             m_right_trigger_polarity = val["trigger_polarity"].int_value();
                         }
                     } else {
-                        m_buttons_mappings[val["from"].int_value()] = val["to"].int_value();
+                        table.buttons[from] = to;
                     }
                 }
+                set_table(mapping_table::intern(std::move(table)));
                 result = true;
             } else {
                 gerr("Expected json array when loading gamepad bindings");
@@ -93,7 +94,8 @@ namespace cfg {
         // left and right trigger share an axis garbage is
         // I hope that it's at least consistent across gamepads
         bool saved_trigger = false;
-        for (const auto& val : m_axis_mappings) {
+        const auto table = get_table();
+        for (const auto& val : table->axis) {
             Json obj;
             if ((val.second == axis::LEFT_TRIGGER || val.second == axis::RIGHT_TRIGGER) && !saved_trigger) {
                 obj = Json::object { { "is_axis", true },
@@ -112,7 +114,7 @@ namespace cfg {
             binds.emplace_back(obj);
         }
 
-        for (const auto& val : m_buttons_mappings) {
+        for (const auto& val : table->buttons) {
             Json obj = Json::object { { "is_axis", false }, { "from", val.first }, { "to", val.second } };
             binds.emplace_back(obj);
         }
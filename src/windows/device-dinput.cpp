@@ -485,6 +485,8 @@ int device_dinput::update()
         return result;
     }
 
+    auto table = m_native_binding ? m_native_binding->get_table() : nullptr;
+
     // Don't bother checking anything if nothing changed
     if (!std::equal(m_new_state.rgbButtons, m_new_state.rgbButtons + m_capabilities.dwButtons,
             m_old_state.rgbButtons)) {
@@ -493,8 +495,8 @@ int device_dinput::update()
             bool old_pressed = (m_old_state.rgbButtons[i] & 0x80) == 0x80;
             uint16_t vc = 0;
             float vv = 0.0f;
-            if (m_native_binding) {
-                vc = m_native_binding->m_buttons_mappings[i];
+            if (table) {
+                vc = table->map_button(i);
                 vv = pressed ? 1.0f : 0.0f;
                 m_buttons[vc] = pressed;
             }
@@ -559,11 +561,11 @@ int device_dinput::update()
 
     uint16_t up_code = 0, left_code = 0, down_code = 0, right_code = 0;
 
-    if (m_native_binding) {
-        up_code = m_native_binding->m_buttons_mappings[DPAD_UP];
-        left_code = m_native_binding->m_buttons_mappings[DPAD_LEFT];
-        down_code = m_native_binding->m_buttons_mappings[DPAD_DOWN];
-        right_code = m_native_binding->m_buttons_mappings[DPAD_RIGHT];
+    if (table) {
+        up_code = table->map_button(DPAD_UP);
+        left_code = table->map_button(DPAD_LEFT);
+        down_code = table->map_button(DPAD_DOWN);
+        right_code = table->map_button(DPAD_RIGHT);
 
         m_buttons[up_code] = up;
         m_buttons[down_code] = down;
@@ -596,9 +598,9 @@ int device_dinput::update()
         uint16_t vc = 0;
         float vv = 0.0f;
 
-        if (m_native_binding) {
+        if (table) {
             auto val = *(m_axis_new[i]);
-            vc = m_native_binding->m_axis_mappings[i];
+            vc = table->map_axis(i);
             if (vc == axis::LEFT_TRIGGER || vc == axis::RIGHT_TRIGGER) {
                 if (val > 0) {
                     if (m_native_binding->m_right_trigger_polarity > 0)
@@ -52,6 +52,7 @@ device_xinput::device_xinput(uint8_t id, const xinput_refresh_t& refresh)
 int device_xinput::update()
 {
     int result = 0;
+    auto table = m_native_binding ? m_native_binding->get_table() : nullptr;
     if (m_xinput_refresh(m_id, &m_current_state) == ERROR_SUCCESS) {
         for (const auto& btn : XINPUT_BUTTONS) {
             bool state = m_current_state.wButtons & btn;
@@ -59,8 +60,8 @@ int device_xinput::update()
             uint16_t vc = 0;
             float vv = 0.0f;
 
-            if (m_native_binding) {
-                vc = m_native_binding->m_buttons_mappings[btn];
+            if (table) {
+                vc = table->map_button(btn);
                 m_buttons[vc] = state;
                 vv = state ? 1.0f : 0.0f;
             }
@@ -81,8 +82,8 @@ int device_xinput::update()
     if (m_current_state.var != m_old_state.var) {                                \
         uint16_t vc = 0;                                                         \
         float vv = 0.0f;                                                         \
-        if (m_native_binding) {                                                  \
-            vc = m_native_binding->m_axis_mappings[id];                          \
+        if (table) {                                                             \
+            vc = table->map_axis(id);                                            \
             vv = clamp(m_current_state.var / (float(m)) * mult, -1, 1);          \
             if (vc == axis::LEFT_STICK_Y || vc == axis::RIGHT_STICK_Y)           \
                 vv *= -1; /* Xinput inverts them for some reason */              \
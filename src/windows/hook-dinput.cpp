@@ -31,13 +31,13 @@ BOOL CALLBACK enum_callback(LPCDIDEVICEINSTANCE dev, LPVOID data)
     auto h = static_cast<hook_dinput*>(data);
     auto id = device_dinput::make_id(dev);
     auto existing_device = h->get_device_by_id(id); /* If it's already connected */
-    auto cached_device = h->m_device_cache[id]; /* If it was connected before */
+    auto cached_device = h->get_cached_device(id); /* If it was connected before */
 
     if (existing_device) {
         existing_device->set_valid();
     } else if (cached_device) {
         cached_device->set_valid();
-        h->m_devices.emplace_back(cached_device);
+        h->add_device(cached_device);
         if (h->m_reconnect_handler)
             h->m_reconnect_handler(cached_device);
     } else {
@@ -45,19 +45,14 @@ BOOL CALLBACK enum_callback(LPCDIDEVICEINSTANCE dev, LPVOID data)
 
         if (new_device->is_valid()) {
             new_device->set_index(h->m_dev_counter++);
-            h->m_devices.emplace_back(dynamic_pointer_cast<device>(new_device));
+            h->add_device(new_device);
             auto b = h->get_binding_for_device(new_device->get_id());
 
-            if (b) {
-                new_device->set_binding(move(b));
-            } else {
-                auto b = make_shared<cfg::binding_dinput>(cfg::dinput_default_binding);
-                new_device->set_binding(dynamic_pointer_cast<cfg::binding>(b));
-            }
+            new_device->set_binding(b ? move(b) : h->make_default_binding());
 
             if (h->m_connect_handler)
                 h->m_connect_handler(new_device);
-            h->m_device_cache[new_device->get_id()] = new_device;
+            h->cache_device(new_device);
         }
     }
     return DIENUM_CONTINUE;
@@ -45,29 +45,24 @@ void hook_xinput::query_devices()
             std::string id = XINPUT_DEVICE_NAME_BASE + std::to_string(i);
 
             auto existing_device = get_device_by_id(id);
-            auto cached_device = m_device_cache[id];
+            auto cached_device = get_cached_device(id);
 
             if (existing_device) {
                 existing_device->set_valid();
             } else if (cached_device) {
                 cached_device->set_valid();
-                m_devices.emplace_back(cached_device);
+                add_device(cached_device);
                 if (m_reconnect_handler)
                     m_reconnect_handler(cached_device);
             } else {
                 auto new_device = std::make_shared<device_xinput>(i, m_xinput_refresh);
                 new_device->set_index(i);
-                m_devices.emplace_back(new_device);
+                add_device(new_device);
                 auto b = get_binding_for_device(new_device->get_id());
 
-                if (b) {
-                    new_device->set_binding(std::move(b));
-                } else {
-                    auto b = std::make_shared<cfg::binding_xinput>(cfg::xinput_default_binding);
-                    new_device->set_binding(std::dynamic_pointer_cast<cfg::binding>(b));
-                }
+                new_device->set_binding(b ? std::move(b) : make_default_binding());
                 new_device->set_valid();
-                m_device_cache[id] = new_device;
+                cache_device(new_device);
                 if (m_connect_handler)
                     m_connect_handler(new_device);
             }
@@ -0,0 +1,581 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <gamepad/binding-default.hpp>
+#include <libgamepad.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef LGP_LINUX
+#include "linux/device-linux.hpp"
+#include <ctime>
+#include <fcntl.h>
+#include <linux/joystick.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace gamepad;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+/* Hook without a native backend, devices and bindings are added by the benchmarks */
+class bench_hook : public hook {
+public:
+    void query_devices() override { }
+
+#ifdef LGP_ENABLE_JSON
+    std::shared_ptr<cfg::binding> make_native_binding(const json11::Json& j) override
+    {
+        return std::make_shared<cfg::binding>(j);
+    }
+
+    const json11::Json& get_default_binding() override
+    {
+        static std::string err;
+        static json11::Json j = json11::Json::parse(defaults::linux_bind_json, err);
+        return j;
+    }
+#endif
+
+    using hook::add_device;
+};
+
+template <class F>
+double ns_per_op(size_t count, F f)
+{
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < count; i++)
+        f(i);
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / count;
+}
+
+volatile size_t sink = 0;
+
+void bench_lookup()
+{
+    static const size_t counts[] = { 100, 1000, 5000 };
+
+    for (const auto count : counts) {
+        bench_hook h;
+        std::vector<std::string> device_ids, binding_names;
+
+        for (size_t i = 0; i < count; i++) {
+            binding_names.emplace_back("binding " + std::to_string(i));
+            device_ids.emplace_back("(js" + std::to_string(i) + ") Bench gamepad");
+            auto b = std::make_shared<cfg::binding>();
+            b->set_name(binding_names.back());
+            h.add_binding(b);
+            h.get_binding_map()[device_ids.back()] = binding_names.back();
+        }
+
+        /* Connecting devices resolves the binding for each new device */
+        auto connect = ns_per_op(count, [&](size_t i) {
+            auto dev = std::make_shared<device>();
+            dev->set_name(device_ids[i]);
+            h.add_device(dev);
+            dev->set_binding(h.get_binding_for_device(dev->get_id()));
+        });
+
+        auto by_name = ns_per_op(count, [&](size_t i) { sink += h.get_binding_by_name(binding_names[i]) != nullptr; });
+        auto by_id = ns_per_op(count, [&](size_t i) { sink += h.get_device_by_id(device_ids[i]) != nullptr; });
+        auto for_device = ns_per_op(count, [&](size_t i) { sink += h.get_binding_for_device(device_ids[i]) != nullptr; });
+
+        printf("lookup: %5zu devices/bindings: connect %8.1f ns, get_binding_by_name %6.1f ns, "
+               "get_device_by_id %6.1f ns, get_binding_for_device %6.1f ns\n",
+            count, connect, by_name, by_id, for_device);
+    }
+}
+
+void bench_default_binding()
+{
+    static const size_t count = 10000;
+    bench_hook h;
+    std::vector<std::shared_ptr<cfg::binding>> bindings;
+    bindings.reserve(count);
+
+    auto compile = ns_per_op(count, [&](size_t) { bindings.emplace_back(h.make_native_binding(h.get_default_binding())); });
+    bindings.clear();
+    auto clone = ns_per_op(count, [&](size_t) { bindings.emplace_back(h.make_default_binding()); });
+
+    /* All clones share one table until one of them is modified */
+    auto shared = bindings.back()->get_table();
+    auto count_sharing = [&]() {
+        size_t sharing = 0;
+        for (const auto& b : bindings)
+            sharing += b->get_table() == shared;
+        return sharing;
+    };
+    auto before = count_sharing();
+    bindings.front()->get_button_mappings()[0] = button::B;
+    bindings.front()->commit();
+    auto after = count_sharing();
+
+    printf("binding: compile from json %8.1f ns, clone default %6.1f ns, %zu/%zu share a table, "
+           "%zu after modifying one\n",
+        compile, clone, before, count, after);
+}
+
+#ifdef LGP_ENABLE_JSON
+/* Bindings file with count copies of the default binding */
+json11::Json make_bindings_document(size_t count)
+{
+    bench_hook h;
+    std::vector<json11::Json> bindings;
+    for (size_t i = 0; i < count; i++) {
+        auto b = h.make_default_binding();
+        b->set_name("Binding " + std::to_string(i) + " \"with\" escapes\n");
+        json11::Json j;
+        b->save(j);
+        bindings.emplace_back(j);
+    }
+    return json11::Json::object { { "bindings", bindings }, { "bindings_map", json11::Json::array {} },
+        { "scale", 0.1 }, { "offset", -1234.5678 } };
+}
+
+void bench_json_dump()
+{
+    static const size_t rounds = 20;
+    auto doc = make_bindings_document(2000);
+    size_t size = 0;
+
+    auto t = ns_per_op(rounds, [&](size_t) {
+        std::string out;
+        doc.dump(out);
+        size = out.size();
+    });
+    printf("json dump: %zu bytes in %8.1f us (%6.1f MB/s)\n", size, t / 1000, size / (t / 1000));
+}
+
+void bench_json_parse()
+{
+    static const size_t rounds = 20;
+    auto doc = make_bindings_document(2000);
+    /* Parse the compact form and an indented one with long whitespace runs */
+    std::string compact = doc.dump(), indented;
+    indented.reserve(compact.size() * 2);
+    size_t depth = 0;
+    for (const auto c : compact) {
+        indented += c;
+        if (c == '{' || c == '[')
+            depth++;
+        else if (c == '}' || c == ']')
+            depth--;
+        if (c == '{' || c == '[' || c == ',')
+            indented.append("\n").append(depth * 4, ' ');
+    }
+
+    /* Long string values, e.g. device names and paths in event dumps */
+    json11::Json::array strings;
+    for (size_t i = 0; i < 20000; i++)
+        strings.emplace_back("/dev/input/by-id/usb-Bench_Gamepad_" + std::string(160, 'x') + "-event-joystick "
+            + std::to_string(i));
+    std::string text = json11::Json(strings).dump();
+
+    const std::string* inputs[] = { &compact, &indented, &text };
+    const char* names[] = { "compact", "indented", "strings" };
+    for (size_t i = 0; i < 3; i++) {
+        std::string err;
+        auto t = ns_per_op(rounds, [&](size_t) { sink += json11::Json::parse(*inputs[i], err).is_object(); });
+        printf("json parse: %-8s %zu bytes in %8.1f us (%6.1f MB/s)%s\n", names[i], inputs[i]->size(), t / 1000,
+            inputs[i]->size() / (t / 1000), err.empty() ? "" : " (parse error)");
+    }
+}
+#endif
+
+#ifdef LGP_LINUX
+/* Linux hook with devices added by the benchmark instead of found in /dev/input */
+class bench_linux_hook : public hook_linux {
+public:
+    bench_linux_hook()
+        : hook_linux(hook_type::JS)
+    {
+    }
+
+    void query_devices() override { }
+
+    using hook::add_device;
+};
+
+double cpu_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Js devices read from fifos in a temporary directory */
+struct fifo_devices {
+    std::string dir;
+    std::vector<std::string> paths;
+    std::vector<int> writers;
+
+    bool create(size_t count)
+    {
+        char tmpl[] = "/tmp/libgamepad-bench-XXXXXX";
+        if (!mkdtemp(tmpl))
+            return false;
+        dir = tmpl;
+        for (size_t i = 0; i < count; i++) {
+            paths.emplace_back(dir + "/js" + std::to_string(i));
+            mkfifo(paths.back().c_str(), 0600);
+        }
+        return true;
+    }
+
+    /* Readers have to exist before the fifos can be opened for writing without blocking */
+    void add_to(bench_linux_hook& h)
+    {
+        for (size_t i = 0; i < paths.size(); i++) {
+            auto dev = std::make_shared<device_linux>(paths[i]);
+            dev->set_index(int(i));
+            dev->set_binding(h.make_default_binding());
+            h.add_device(dev);
+            writers.emplace_back(open(paths[i].c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC));
+        }
+    }
+
+    void close_writers()
+    {
+        for (const auto fd : writers)
+            close(fd);
+        writers.clear();
+    }
+
+    ~fifo_devices()
+    {
+        close_writers();
+        for (const auto& p : paths)
+            unlink(p.c_str());
+        if (!dir.empty())
+            rmdir(dir.c_str());
+    }
+};
+
+/* 64 js devices read from fifos, measures the cpu time the hook thread burns while
+ * they're idle and how long a button press takes from write() to the handler */
+void bench_io_engine()
+{
+    static const size_t device_count = 64, presses = 500;
+    static const io_engine_type::type engines[] = { io_engine_type::READ, io_engine_type::EPOLL,
+        io_engine_type::IO_URING, io_engine_type::THREAD_PER_DEVICE, io_engine_type::SHARDED };
+    static const char* names[] = { "read", "epoll", "io_uring", "threads", "sharded" };
+
+    fifo_devices fifos;
+    if (!fifos.create(device_count)) {
+        printf("io engine: couldn't create fifo directory\n");
+        return;
+    }
+
+    for (size_t e = 0; e < 5; e++) {
+        bench_linux_hook h;
+        if (!h.set_io_engine(engines[e])) {
+            printf("io engine: %-8s not available\n", names[e]);
+            continue;
+        }
+        h.set_sleep_time(ms(1));
+        fifos.add_to(h);
+        std::atomic<size_t> handled { 0 };
+        std::vector<bench_clock::time_point> sent(device_count);
+        std::vector<double> latencies;
+        h.set_button_event_handler([&](std::shared_ptr<device> dev) {
+            latencies.emplace_back(
+                std::chrono::duration<double, std::micro>(bench_clock::now() - sent[dev->get_index()]).count());
+            handled++;
+        });
+        h.start();
+
+        /* Let the engine attach the devices before measuring */
+        std::this_thread::sleep_for(ms(50));
+        const auto idle_start = cpu_ms();
+        const auto idle_wall = bench_clock::now();
+        std::this_thread::sleep_for(ms(500));
+        const auto idle_cpu = (cpu_ms() - idle_start)
+            / std::chrono::duration<double, std::milli>(bench_clock::now() - idle_wall).count() * 100;
+
+        struct js_event ev = {};
+        ev.type = JS_EVENT_BUTTON;
+        for (size_t i = 0; i < presses; i++) {
+            const auto index = i % device_count;
+            const auto expected = handled + 1;
+            ev.value = int16_t(i / device_count % 2 == 0);
+            sent[index] = bench_clock::now();
+            if (write(fifos.writers[index], &ev, sizeof(ev)) != sizeof(ev))
+                break;
+            const auto deadline = bench_clock::now() + ms(200);
+            while (handled < expected && bench_clock::now() < deadline)
+                std::this_thread::yield();
+        }
+        h.stop();
+
+        h.get_mutex()->lock();
+        auto sorted = latencies;
+        h.get_mutex()->unlock();
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0;
+        for (const auto l : sorted)
+            mean += l;
+        mean = sorted.empty() ? 0 : mean / sorted.size();
+        const auto p99 = sorted.empty() ? 0 : sorted[sorted.size() * 99 / 100];
+
+        printf("io engine: %-8s %zu devices idle cpu %5.1f%%, %zu/%zu presses, latency mean %7.1f us p99 %7.1f us\n",
+            names[e], device_count, idle_cpu, sorted.size(), presses, mean, p99);
+
+        h.close_devices();
+        fifos.close_writers();
+    }
+}
+
+/* The io_engine benchmark without the hook thread, the caller polls the hook's
+ * descriptor and pumps it, for each engine that has a descriptor */
+void bench_pump()
+{
+    static const size_t device_count = 64, presses = 500;
+    static const io_engine_type::type engines[] = { io_engine_type::EPOLL, io_engine_type::IO_URING };
+    static const char* names[] = { "epoll", "io_uring" };
+
+    fifo_devices fifos;
+    if (!fifos.create(device_count)) {
+        printf("pump: couldn't create fifo directory\n");
+        return;
+    }
+
+    for (size_t e = 0; e < 2; e++) {
+        bench_linux_hook h;
+        if (!h.set_io_engine(engines[e])) {
+            printf("pump: %-8s not available\n", names[e]);
+            continue;
+        }
+        fifos.add_to(h);
+        size_t handled = 0;
+        h.set_button_event_handler([&](std::shared_ptr<device>) { handled++; });
+        if (!h.start_pump()) {
+            printf("pump: %-8s couldn't start\n", names[e]);
+            fifos.close_writers();
+            continue;
+        }
+
+        /* The first pump attaches the devices, after that an idle descriptor never polls readable */
+        struct pollfd pfd = { h.get_poll_fd(), POLLIN, 0 };
+        h.pump();
+        size_t wakeups = 0;
+        const auto idle_end = bench_clock::now() + ms(200);
+        while (bench_clock::now() < idle_end) {
+            if (poll(&pfd, 1, 10) > 0) {
+                wakeups++;
+                h.pump();
+            }
+        }
+
+        struct js_event ev = {};
+        ev.type = JS_EVENT_BUTTON;
+        double total = 0;
+        size_t done = 0;
+        for (size_t i = 0; i < presses; i++) {
+            const auto index = i % device_count;
+            ev.value = int16_t(i / device_count % 2 == 0);
+            const auto sent = bench_clock::now();
+            if (write(fifos.writers[index], &ev, sizeof(ev)) != sizeof(ev))
+                break;
+            const auto expected = handled + 1;
+            while (handled < expected && poll(&pfd, 1, 200) > 0)
+                h.pump();
+            if (handled < expected)
+                break;
+            total += std::chrono::duration<double, std::micro>(bench_clock::now() - sent).count();
+            done++;
+        }
+        h.stop();
+
+        printf("pump: %-8s %zu devices %zu idle wakeups, %zu/%zu presses, latency mean %7.1f us\n", names[e],
+            device_count, wakeups, done, presses, done ? total / done : 0);
+        fifos.close_writers();
+    }
+}
+
+/* A 1000 Hz pad on a hook thread with a 1 ms sleep time, latency of its presses
+ * and the CPU time spent spinning for a few spin budgets */
+void bench_spin()
+{
+    static const size_t device_count = 4, presses = 300;
+    static const io_engine_type::type engines[] = { io_engine_type::READ, io_engine_type::EPOLL };
+    static const char* names[] = { "read", "epoll" };
+    static const mcs budgets[] = { mcs(0), mcs(250), mcs(1000) };
+
+    fifo_devices fifos;
+    if (!fifos.create(device_count)) {
+        printf("spin: couldn't create fifo directory\n");
+        return;
+    }
+
+    for (size_t e = 0; e < 2; e++) {
+        for (const auto budget : budgets) {
+            bench_linux_hook h;
+            if (!h.set_io_engine(engines[e])) {
+                printf("spin: %-8s not available\n", names[e]);
+                break;
+            }
+            h.set_sleep_time(ms(1));
+            h.set_spin_budget(budget);
+            fifos.add_to(h);
+            std::atomic<size_t> handled { 0 };
+            bench_clock::time_point sent;
+            std::vector<double> latencies;
+            h.set_button_event_handler([&](std::shared_ptr<device>) {
+                latencies.emplace_back(std::chrono::duration<double, std::micro>(bench_clock::now() - sent).count());
+                handled++;
+            });
+            h.start();
+            std::this_thread::sleep_for(ms(50));
+            h.reset_spin_stats();
+
+            /* One press per millisecond, spread over the devices */
+            struct js_event ev = {};
+            ev.type = JS_EVENT_BUTTON;
+            const auto start = bench_clock::now();
+            for (size_t i = 0; i < presses; i++) {
+                const auto expected = handled + 1;
+                ev.value = int16_t(i / device_count % 2 == 0);
+                h.get_mutex()->lock();
+                sent = bench_clock::now();
+                h.get_mutex()->unlock();
+                if (write(fifos.writers[i % device_count], &ev, sizeof(ev)) != sizeof(ev))
+                    break;
+                const auto deadline = bench_clock::now() + ms(200);
+                while (handled < expected && bench_clock::now() < deadline)
+                    std::this_thread::yield();
+                std::this_thread::sleep_until(start + ms(i + 1));
+            }
+            const auto wall = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+            const auto stats = h.get_spin_stats();
+            h.stop();
+
+            h.get_mutex()->lock();
+            auto sorted = latencies;
+            h.get_mutex()->unlock();
+            std::sort(sorted.begin(), sorted.end());
+            double mean = 0;
+            for (const auto l : sorted)
+                mean += l;
+            mean = sorted.empty() ? 0 : mean / sorted.size();
+            const auto p99 = sorted.empty() ? 0 : sorted[sorted.size() * 99 / 100];
+            const auto spin_ms = std::chrono::duration<double, std::milli>(stats.cpu_time).count();
+
+            printf("spin: %-8s budget %4lld us, %zu/%zu presses, latency mean %7.1f us p99 %7.1f us, "
+                   "spin cpu %6.1f ms (%5.1f%%), %llu/%llu windows hit\n",
+                names[e], (long long)budget.count(), sorted.size(), presses, mean, p99, spin_ms, spin_ms / wall * 100,
+                (unsigned long long)stats.hits, (unsigned long long)stats.windows);
+
+            h.close_devices();
+            fifos.close_writers();
+        }
+    }
+}
+
+/* 128 js devices flooded with button presses, measures how many events per second
+ * the sharded engine gets through with 1 to 8 io threads */
+void bench_sharded()
+{
+    static const size_t device_count = 128, rounds = 40, burst = 8;
+    static const unsigned thread_counts[] = { 1, 2, 4, 8 };
+
+    fifo_devices fifos;
+    if (!fifos.create(device_count)) {
+        printf("sharded: couldn't create fifo directory\n");
+        return;
+    }
+
+    for (const auto threads : thread_counts) {
+        bench_linux_hook h;
+        if (!h.set_io_engine(io_engine_type::SHARDED, threads))
+            continue;
+        fifos.add_to(h);
+
+        /* Every event toggles the button, so each one reaches the handler */
+        std::atomic<size_t> handled { 0 };
+        h.set_button_event_handler([&](std::shared_ptr<device>) { handled++; });
+        h.start();
+        std::this_thread::sleep_for(ms(50));
+
+        const size_t total = device_count * rounds * burst;
+        std::vector<struct js_event> events(burst);
+        const auto start = bench_clock::now();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < burst; i++) {
+                events[i] = {};
+                events[i].type = JS_EVENT_BUTTON;
+                events[i].value = int16_t((r * burst + i) % 2 == 0);
+            }
+            for (const auto fd : fifos.writers)
+                sink += size_t(write(fd, events.data(), events.size() * sizeof(struct js_event)));
+        }
+        const auto deadline = bench_clock::now() + std::chrono::seconds(10);
+        while (handled < total && bench_clock::now() < deadline)
+            std::this_thread::sleep_for(mcs(100));
+        const auto t = std::chrono::duration<double>(bench_clock::now() - start).count();
+        h.stop();
+
+        printf("sharded: %u io threads, %zu devices: %zu/%zu events in %7.1f ms (%9.0f events/s)\n", threads,
+            device_count, handled.load(), total, t * 1000, handled / t);
+
+        h.close_devices();
+        fifos.close_writers();
+    }
+}
+#endif
+
+struct benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const benchmark benchmarks[] = {
+    { "lookup", bench_lookup },
+    { "binding", bench_default_binding },
+#ifdef LGP_LINUX
+    { "io_engine", bench_io_engine },
+    { "sharded", bench_sharded },
+    { "pump", bench_pump },
+    { "spin", bench_spin },
+#endif
+#ifdef LGP_ENABLE_JSON
+    { "json_dump", bench_json_dump },
+    { "json_parse", bench_json_parse },
+#endif
+};
+}
+
+int main(int argc, char** argv)
+{
+    /* Run all benchmarks, or only the ones named on the command line */
+    for (const auto& b : benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected |= strcmp(argv[i], b.name) == 0;
+        if (selected)
+            b.run();
+    }
+    return 0;
+}
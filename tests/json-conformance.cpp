@@ -0,0 +1,172 @@
+/**
+ ** This file is part of the libgamepad project.
+ ** Copyright 2025 univrsal <uni@vrsal.cc>.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU Lesser General Public License as
+ ** published by the Free Software Foundation, either version 3 of the
+ ** License, or (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU Lesser General Public License for more details.
+ **
+ ** You should have received a copy of the GNU Lesser General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <cstdio>
+#include <json/json11.hpp>
+#include <string>
+
+using json11::Json;
+
+namespace {
+struct corpus_entry {
+    const char* input;
+    const char* expected; /* Compact dump of the result, nullptr if parsing must fail */
+};
+
+/* clang-format off */
+const corpus_entry corpus[] = {
+    /* Scalars and whitespace */
+    { "null", "null" },
+    { " \t\r\n true \n", "true" },
+    { "-12", "-12" },
+    { "0.5", "0.5" },
+    { "1e3", "1000" },
+    { "\"\"", "\"\"" },
+    { "", nullptr },
+    { "   ", nullptr },
+    { "nul", nullptr },
+    { "01", nullptr },
+    { "1.", nullptr },
+    { "[1,]", nullptr },
+    { "{\"a\" 1}", nullptr },
+    { "[1] x", nullptr },
+    { "\v1", nullptr },
+    { "[ \n\v     1]", nullptr },
+    { "[ \t\b     1]", nullptr },
+    { "[ \r\f     1]", nullptr },
+    { "[       !1]", nullptr },
+    { "[        \v       1]", nullptr },
+
+    /* Numbers are dumped with the fewest digits that parse back to them */
+    { "0.1", "0.1" },
+    { "-2.25", "-2.25" },
+    { "0.30000000000000004", "0.30000000000000004" },
+    { "3.141592653589793", "3.141592653589793" },
+    { "1e-7", "1e-07" },
+    { "1.5e300", "1.5e+300" },
+    { "123456789012.5", "123456789012.5" },
+
+    /* Strings and escapes */
+    { "\"a\\\"b\\\\c\\/d\"", "\"a\\\"b\\\\c/d\"" },
+    { "\"\\b\\f\\n\\r\\t\"", "\"\\b\\f\\n\\r\\t\"" },
+    { "\"\\u0041\\u00e9\\u20ac\"", "\"A\xc3\xa9\xe2\x82\xac\"" },
+    { "\"\\ud83d\\ude00\"", "\"\xf0\x9f\x98\x80\"" },
+    { "\"\\u001f\"", "\"\\u001f\"" },
+    { "\"\xc3\xa9\xe2\x82\xac\"", "\"\xc3\xa9\xe2\x82\xac\"" },
+    { "\"\\x\"", nullptr },
+    { "\"\\u12\"", nullptr },
+    { "\"abc", nullptr },
+    { "\"a\tb\"", nullptr },
+    { "\"a\nb\"", nullptr },
+    { "\"\x01\"", nullptr },
+
+    /* Nesting */
+    { "[]", "[]" },
+    { "{}", "{}" },
+    { "[ 1 , [ 2 , { } ] , \"x\" ]", "[1, [2, {}], \"x\"]" },
+    { "{ \"b\" : [ true , false ] , \"a\" : null }", "{\"a\": null, \"b\": [true, false]}" },
+    { "{\"a\":1}}", nullptr },
+    { "[[[", nullptr },
+};
+/* clang-format on */
+
+int failures = 0;
+
+void check(const std::string& input, const char* expected, const char* what)
+{
+    std::string err;
+    auto j = Json::parse(input, err);
+    bool ok;
+
+    if (expected)
+        ok = err.empty() && j.dump() == expected;
+    else
+        ok = !err.empty();
+
+    if (!ok) {
+        failures++;
+        printf("FAIL %s: '%s'\n  expected: %s\n  got:      %s%s\n", what, input.c_str(),
+            expected ? expected : "parse error", err.empty() ? j.dump().c_str() : "parse error: ",
+            err.c_str());
+    }
+}
+
+/* Moves specials and whitespace runs across every offset of the 8, 16 and
+ * 32 byte blocks used by the scanners and through the scalar tails */
+void check_block_boundaries()
+{
+    static const char* specials[] = { "\\\"", "\\\\", "\\n", "\\u00e9", "\xc3\xa9" };
+    static const char* decoded[] = { "\\\"", "\\\\", "\\n", "\xc3\xa9", "\xc3\xa9" };
+
+    for (size_t len = 0; len < 70; len++) {
+        for (size_t s = 0; s < sizeof(specials) / sizeof(*specials); s++) {
+            for (size_t pos = 0; pos <= len; pos += len > 20 ? 7 : 1) {
+                std::string body(len, 'a'), expected_body(len, 'a');
+                body.insert(pos, specials[s]);
+                expected_body.insert(pos, decoded[s]);
+                check("\"" + body + "\"", ("\"" + expected_body + "\"").c_str(), "string block");
+            }
+        }
+
+        /* Raw control character and missing closing quote at each offset */
+        std::string body(len, 'b');
+        check("\"" + body + "\x1f\"", nullptr, "control character");
+        check("\"" + body, nullptr, "unterminated string");
+
+        /* Whitespace runs of every length, mixing all four whitespace characters */
+        std::string ws;
+        for (size_t i = 0; i < len; i++)
+            ws += " \t\r\n"[i % 4];
+        check(ws + "[" + ws + "1" + ws + "," + ws + "\"" + body + "\"" + ws + "]" + ws,
+            ("[1, \"" + body + "\"]").c_str(), "whitespace block");
+        check(ws + "\v", nullptr, "non-json whitespace");
+    }
+
+    /* Bytes >= 0x80 must not be mistaken for control characters */
+    std::string high;
+    for (int c = 0x80; c < 0x100; c++)
+        high += static_cast<char>(c);
+    check("\"" + high + "\"", ("\"" + high + "\"").c_str(), "high bytes");
+}
+
+void check_round_trip()
+{
+    Json::array items;
+    for (int i = 0; i < 300; i++)
+        items.emplace_back(Json::object { { "name", std::string(i % 40, 'n') + "\"\\\n" }, { "value", i * 0.25 } });
+    const std::string dumped = Json(items).dump();
+
+    std::string err;
+    if (Json::parse(dumped, err) != Json(items)) {
+        failures++;
+        printf("FAIL round trip: %s\n", err.c_str());
+    }
+}
+}
+
+int main()
+{
+    for (const auto& entry : corpus)
+        check(entry.input, entry.expected, "corpus");
+    check_block_boundaries();
+    check_round_trip();
+
+    if (failures)
+        printf("%i json conformance checks failed\n", failures);
+    return failures ? 1 : 0;
+}